@@ -17,6 +17,35 @@
 
 #include "aesd-circular-buffer.h"
 
+/**
+ * Fill buffer->segment with the part of chunked entry @param index holding byte @param offset
+ * of the entry, which is changed to the offset of that byte in the segment.
+ */
+static struct aesd_buffer_entry *aesd_circular_buffer_find_segment(struct aesd_circular_buffer *buffer,
+            int index, size_t *offset)
+{
+    const struct aesd_chunk *chunk = buffer->chunk[index];
+    const char *data = buffer->entry[index].buffptr;
+    size_t remaining = buffer->entry[index].size;
+    size_t avail = chunk->used - (data - chunk->data);
+
+    if(avail > remaining)
+    {
+        avail = remaining;
+    }
+    while(*offset >= avail && remaining > avail)
+    {
+        *offset -= avail;
+        remaining -= avail;
+        chunk = chunk->next;
+        data = chunk->data;
+        avail = chunk->used < remaining ? chunk->used : remaining;
+    }
+    buffer->segment.buffptr = data;
+    buffer->segment.size = avail;
+    return &buffer->segment;
+}
+
 /**
  * @param buffer the buffer to search for corresponding offset.  Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced
@@ -25,7 +54,9 @@
  *      buffptr member corresponding to char_offset.  This value is only set when a matching char_offset is found
  *      in aesd_buffer.
  * @return the struct aesd_buffer_entry structure representing the position described by char_offset, or
- * NULL if this position is not available in the buffer (not enough data is written).
+ * NULL if this position is not available in the buffer (not enough data is written).  For an entry stored as
+ * a chain of chunks this is buffer->segment, describing the part of the entry in the chunk holding char_offset,
+ * which stays valid until the next call.
  */
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
@@ -42,7 +73,8 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
             break;
         }
 
-        if( (buffer_offset + buffer->entry[buffer_position].size) < char_offset)
+        // a position at the end of an entry is the start of the next one
+        if( (buffer_offset + buffer->entry[buffer_position].size) <= char_offset)
         {
             buffer_offset += buffer->entry[buffer_position].size;
         }
@@ -59,6 +91,10 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
                 }
             }
             result = &buffer->entry[buffer_position];
+            if(buffer->chunk[buffer_position] != NULL)
+            {
+                result = aesd_circular_buffer_find_segment(buffer, buffer_position, &str_index);
+            }
             *entry_offset_byte_rtn = str_index;
             found = true;
         }
@@ -74,32 +110,99 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     return result;
 }
 
+/**
+* Advances buffer->in_offs past the slot which was just written, and buffer->out_offs
+* as well if the oldest entry was overwritten.
+*/
+static void aesd_circular_buffer_advance(struct aesd_circular_buffer *buffer)
+{
+    buffer->in_offs++;
+    buffer->in_offs %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+
+    if(buffer->full)
+    {
+        buffer->out_offs = buffer->in_offs;
+    }
+    else if(buffer->in_offs == buffer->out_offs)
+    {
+        buffer->full = true;
+    }
+}
+
 /**
 * Adds entry @param add_entry to @param buffer in the location specified in buffer->in_offs.
 * If the buffer was already full, overwrites the oldest entry and advances buffer->out_offs to the
 * new start location.
 * Any necessary locking must be handled by the caller
 * Any memory referenced in @param add_entry must be allocated by and/or must have a lifetime managed by the caller.
+* Only buffptr and size of @param add_entry are used.
 */
 void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry)
 {
-    buffer->entry[buffer->in_offs] = *add_entry;
-    buffer->in_offs++;
-    
-    if(buffer->full)
+    buffer->entry[buffer->in_offs].buffptr = add_entry->buffptr;
+    buffer->entry[buffer->in_offs].size = add_entry->size;
+    buffer->chunk[buffer->in_offs] = NULL;
+    aesd_circular_buffer_advance(buffer);
+}
+
+/**
+* Adds an entry of @param size bytes starting at @param offset in @param chunk and continuing
+* in the chunks following it.  The slot's buffptr points to the start of the entry in @param chunk
+* and its size covers the whole entry, aesd_circular_buffer_find_entry_offset_for_fpos() follows
+* the chain.  Otherwise behaves like aesd_circular_buffer_add_entry().
+* Any necessary locking must be handled by the caller, which also manages the lifetime of the chunks.
+*/
+void aesd_circular_buffer_add_chunked_entry(struct aesd_circular_buffer *buffer, struct aesd_chunk *chunk,
+            size_t offset, size_t size)
+{
+    buffer->entry[buffer->in_offs].buffptr = chunk->data + offset;
+    buffer->entry[buffer->in_offs].size = size;
+    buffer->chunk[buffer->in_offs] = chunk;
+    aesd_circular_buffer_advance(buffer);
+}
+
+/**
+* Copies the @param size bytes at @param data into the slot at buffer->in_offs, so reading
+* the entry does not need to follow a pointer to separately allocated memory.  Otherwise
+* behaves like aesd_circular_buffer_add_entry().
+* Any necessary locking must be handled by the caller, which must also release any memory
+* referenced by the entry being overwritten before the call.
+* @return false without modifying @param buffer if @param size exceeds AESDCHAR_INLINE_ENTRY_SIZE
+*/
+bool aesd_circular_buffer_add_inline_entry(struct aesd_circular_buffer *buffer, const char *data, size_t size)
+{
+    struct aesd_buffer_entry *slot = &buffer->entry[buffer->in_offs];
+
+    if(size > AESDCHAR_INLINE_ENTRY_SIZE)
     {
-        buffer->out_offs++;
-        buffer->out_offs %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        return false;
     }
-    
-    if( (buffer->in_offs >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) 
-     && (buffer->full == false) )
+    memcpy(slot->inline_data, data, size);
+    slot->buffptr = slot->inline_data;
+    slot->size = size;
+    buffer->chunk[buffer->in_offs] = NULL;
+    aesd_circular_buffer_advance(buffer);
+    return true;
+}
+
+/**
+* Removes the oldest entry from @param buffer and clears its slot.
+* Any memory referenced by the entry must be released by the caller beforehand.
+* @return false if @param buffer was empty
+*/
+bool aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer)
+{
+    if(!buffer->full && buffer->in_offs == buffer->out_offs)
     {
-        buffer->full = true;
+        return false;
     }
-
-    buffer->in_offs %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-
+    buffer->entry[buffer->out_offs].buffptr = NULL;
+    buffer->entry[buffer->out_offs].size = 0;
+    buffer->chunk[buffer->out_offs] = NULL;
+    buffer->out_offs++;
+    buffer->out_offs %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->full = false;
+    return true;
 }
 
 /**
@@ -10,14 +10,26 @@
 
 #ifdef __KERNEL__
 #include <linux/types.h>
+#include <linux/cache.h>
+#define AESD_CACHE_LINE_SIZE SMP_CACHE_BYTES
 #else
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
+#define AESD_CACHE_LINE_SIZE 64
 #endif
 
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
 
+/**
+ * Entries up to this size can be stored inside the ring slot itself, see
+ * aesd_circular_buffer_add_inline_entry().  By default a slot fills exactly
+ * one cache line, define a larger value to trade memory for fewer allocations.
+ */
+#ifndef AESDCHAR_INLINE_ENTRY_SIZE
+#define AESDCHAR_INLINE_ENTRY_SIZE (AESD_CACHE_LINE_SIZE - sizeof(const char *) - sizeof(size_t))
+#endif
+
 struct aesd_buffer_entry
 {
     /**
@@ -28,6 +40,29 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Contents of short entries, buffptr points here for inline entries
+     */
+    char inline_data[AESDCHAR_INLINE_ENTRY_SIZE];
+} __attribute__((aligned(AESD_CACHE_LINE_SIZE)));
+
+/**
+ * Page sized piece of an entry stored as a chain, see
+ * aesd_circular_buffer_add_chunked_entry().  A chunk may hold the end of one
+ * entry and the start of the next, its lifetime is managed by the caller.
+ */
+struct aesd_chunk
+{
+    struct aesd_chunk *next;
+    /**
+     * References held by the caller, the buffer does not use this
+     */
+    unsigned int refs;
+    /**
+     * Number of bytes stored in data
+     */
+    size_t used;
+    char data[];
 };
 
 struct aesd_circular_buffer
@@ -36,6 +71,15 @@ struct aesd_circular_buffer
      * An array of pointers to memory allocated for the most recent write operations
      */
     struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * First chunk of each entry stored as a chain of chunks, NULL for other entries
+     */
+    struct aesd_chunk *chunk[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    /**
+     * The part of a chunked entry returned by the last
+     * aesd_circular_buffer_find_entry_offset_for_fpos() call
+     */
+    struct aesd_buffer_entry segment;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
@@ -56,8 +100,24 @@ extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos
 
 extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern bool aesd_circular_buffer_add_inline_entry(struct aesd_circular_buffer *buffer, const char *data, size_t size);
+
+extern void aesd_circular_buffer_add_chunked_entry(struct aesd_circular_buffer *buffer, struct aesd_chunk *chunk,
+            size_t offset, size_t size);
+
+extern bool aesd_circular_buffer_remove_oldest(struct aesd_circular_buffer *buffer);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+/**
+ * @return true if the contents of @param entry are stored in the ring slot itself
+ *  and must not be freed
+ */
+static inline bool aesd_buffer_entry_is_inline(const struct aesd_buffer_entry *entry)
+{
+    return entry->buffptr == entry->inline_data;
+}
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
@@ -69,7 +129,8 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
- *      free(entry->buffptr);
+ *      if(!aesd_buffer_entry_is_inline(entry))
+ *          free(entry->buffptr);
  * }
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
@@ -0,0 +1,60 @@
+/*
+ * aesd_ioctl.h
+ *
+ * ioctl commands of the aesdchar driver, shared with userspace programs.
+ */
+
+#ifndef AESD_IOCTL_H
+#define AESD_IOCTL_H
+
+#ifdef __KERNEL__
+#include <asm-generic/ioctl.h>
+#include <linux/types.h>
+#else
+#include <sys/ioctl.h>
+#include <stdint.h>
+#endif
+
+#define AESD_FILTER_MAX_PATTERN 64
+
+enum aesd_filter_type
+{
+    AESD_FILTER_NONE = 0,
+    /**
+     * Lines containing pattern anywhere, including the newline
+     */
+    AESD_FILTER_SUBSTRING = 1,
+    /**
+     * Lines starting with pattern
+     */
+    AESD_FILTER_PREFIX = 2,
+    /**
+     * Lines with a sequence number of at least min_seq.  The first line
+     * written after the module is loaded has sequence number 0.
+     */
+    AESD_FILTER_MIN_SEQ = 3,
+};
+
+/**
+ * Filter applied to reads on one open file.  Reads then return the matching
+ * lines only, and the file position counts bytes of matching lines.
+ */
+struct aesd_filter
+{
+    uint32_t type;          /* enum aesd_filter_type */
+    uint32_t pattern_len;   /* bytes used in pattern, at most AESD_FILTER_MAX_PATTERN */
+    uint64_t min_seq;
+    char pattern[AESD_FILTER_MAX_PATTERN];
+};
+
+// Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
+#define AESD_IOC_MAGIC 0x16
+
+/**
+ * Set the filter of this open file and rewind it to the start of the
+ * filtered view.  AESD_FILTER_NONE removes a previous filter.
+ */
+#define AESDCHAR_IOCSETFILTER _IOW(AESD_IOC_MAGIC, 2, struct aesd_filter)
+#define AESDCHAR_IOC_MAXNR 2
+
+#endif /* AESD_IOCTL_H */
@@ -0,0 +1,603 @@
+/**
+ * @file aesdchar-stress.c
+ * @brief Multi-threaded load generator and latency benchmark for the aesdchar driver
+ *
+ * Writer threads write newline terminated lines of random text, optionally
+ * split over several write() calls, while reader threads repeatedly read the
+ * whole device with a fixed buffer size, optionally through a filter set with
+ * AESDCHAR_IOCSETFILTER.  At the end the throughput and the
+ * p50/p99/p999 latency of every write() and read() call are printed.
+ *
+ * Built as aesdchar-stress the tool opens the device node (default
+ * /dev/aesdchar).  Built as aesdchar-stress-shim (-DAESD_STRESS_SHIM) it links
+ * main.c against the userspace shim in shim/ and calls the file operations
+ * directly, so driver changes can be compared on the same numbers without
+ * loading a module.  Module parameters are then given with -o name=value.
+ *
+ * Usage: aesdchar-stress [-w writers] [-r readers] [-d seconds] [-l fixed:N|uniform:MIN:MAX|exp:MEAN]
+ *                        [-p split_percent] [-b read_buffer_size] [-f substr:TEXT|prefix:TEXT|seq:N]
+ *                        [-o param=value] [device]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "aesd_ioctl.h"
+#ifdef AESD_STRESS_SHIM
+#include "shim/aesd-shim-api.h"
+#endif
+
+#define STRESS_MAX_LINE 65536
+/*
+ * Latency histogram: values below 64 ns get their own bucket, above that each
+ * power of two is split into 32 linear sub buckets (about 3% resolution).
+ */
+#define HIST_LINEAR     64
+#define HIST_SUB_BITS   5
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP    42
+#define HIST_BUCKETS    (HIST_LINEAR + (HIST_MAX_EXP - 6) * HIST_SUB)
+
+enum line_dist
+{
+    LINE_FIXED,
+    LINE_UNIFORM,
+    LINE_EXP,
+};
+
+struct stress_config
+{
+    const char *device;
+    int writers;
+    int readers;
+    unsigned int seconds;
+    enum line_dist dist;
+    size_t line_min;
+    size_t line_max;
+    double line_mean;
+    unsigned int split_percent;
+    size_t read_size;
+    struct aesd_filter filter;
+};
+
+struct latency_hist
+{
+    uint64_t bucket[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t errors;
+    uint64_t max_ns;
+};
+
+struct stress_thread
+{
+    pthread_t tid;
+    const struct stress_config *config;
+    unsigned int seed;
+    struct latency_hist hist;
+};
+
+static atomic_bool stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(uint64_t ns)
+{
+    unsigned int exp;
+    unsigned int bucket;
+
+    if(ns < HIST_LINEAR)
+    {
+        return (unsigned int)ns;
+    }
+    exp = 63 - __builtin_clzll(ns);
+    bucket = HIST_LINEAR + (exp - 6) * HIST_SUB + (unsigned int)((ns >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+    return bucket < HIST_BUCKETS ? bucket : HIST_BUCKETS - 1;
+}
+
+static uint64_t hist_bucket_value(unsigned int bucket)
+{
+    unsigned int exp;
+    unsigned int sub;
+
+    if(bucket < HIST_LINEAR)
+    {
+        return bucket;
+    }
+    exp = (bucket - HIST_LINEAR) / HIST_SUB + 6;
+    sub = (bucket - HIST_LINEAR) % HIST_SUB;
+    return (uint64_t)(HIST_SUB + sub) << (exp - HIST_SUB_BITS);
+}
+
+static void hist_record(struct latency_hist *hist, uint64_t ns, ssize_t rc)
+{
+    if(rc < 0)
+    {
+        hist->errors++;
+        return;
+    }
+    hist->bucket[hist_bucket(ns)]++;
+    hist->count++;
+    hist->bytes += (uint64_t)rc;
+    if(ns > hist->max_ns)
+    {
+        hist->max_ns = ns;
+    }
+}
+
+static void hist_merge(struct latency_hist *into, const struct latency_hist *from)
+{
+    int i;
+
+    for(i = 0; i < HIST_BUCKETS; i++)
+    {
+        into->bucket[i] += from->bucket[i];
+    }
+    into->count += from->count;
+    into->bytes += from->bytes;
+    into->errors += from->errors;
+    if(from->max_ns > into->max_ns)
+    {
+        into->max_ns = from->max_ns;
+    }
+}
+
+static uint64_t hist_percentile(const struct latency_hist *hist, double percentile)
+{
+    uint64_t target = (uint64_t)ceil(percentile / 100.0 * hist->count);
+    uint64_t seen = 0;
+    int i;
+
+    for(i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += hist->bucket[i];
+        if(seen >= target && seen != 0)
+        {
+            return hist_bucket_value(i);
+        }
+    }
+    return hist->max_ns;
+}
+
+/*
+ * Device access, either through the device node or through the shim
+ */
+#ifdef AESD_STRESS_SHIM
+
+typedef struct aesd_shim_file *stress_handle;
+
+static bool stress_open(const struct stress_config *config, stress_handle *handle)
+{
+    (void)config;
+    *handle = aesd_shim_open();
+    return *handle != NULL;
+}
+
+static void stress_close(stress_handle handle)
+{
+    aesd_shim_release(handle);
+}
+
+static ssize_t stress_write(stress_handle handle, const char *buf, size_t count)
+{
+    return aesd_shim_write(handle, buf, count);
+}
+
+static ssize_t stress_read(stress_handle handle, char *buf, size_t count, long long offset)
+{
+    return aesd_shim_read(handle, buf, count, &offset);
+}
+
+static bool stress_set_filter(stress_handle handle, const struct aesd_filter *filter)
+{
+    return aesd_shim_ioctl(handle, AESDCHAR_IOCSETFILTER, (unsigned long)filter) == 0;
+}
+
+#else
+
+typedef int stress_handle;
+
+static bool stress_open(const struct stress_config *config, stress_handle *handle)
+{
+    *handle = open(config->device, O_RDWR | O_CLOEXEC);
+    if(*handle < 0)
+    {
+        fprintf(stderr, "Could not open %s: %s\n", config->device, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void stress_close(stress_handle handle)
+{
+    close(handle);
+}
+
+static ssize_t stress_write(stress_handle handle, const char *buf, size_t count)
+{
+    return write(handle, buf, count);
+}
+
+static ssize_t stress_read(stress_handle handle, char *buf, size_t count, long long offset)
+{
+    // the driver has no llseek, pread() passes the offset straight to aesd_read()
+    return pread(handle, buf, count, offset);
+}
+
+static bool stress_set_filter(stress_handle handle, const struct aesd_filter *filter)
+{
+    return ioctl(handle, AESDCHAR_IOCSETFILTER, filter) == 0;
+}
+
+#endif
+
+static size_t next_line_length(const struct stress_config *config, unsigned int *seed)
+{
+    size_t len;
+
+    switch(config->dist)
+    {
+        case LINE_UNIFORM:
+            len = config->line_min + (size_t)rand_r(seed) % (config->line_max - config->line_min + 1);
+            break;
+        case LINE_EXP:
+            len = (size_t)(-log(1.0 - (double)rand_r(seed) / ((double)RAND_MAX + 1.0)) * config->line_mean) + 1;
+            break;
+        default:
+            len = config->line_min;
+            break;
+    }
+    if(len < 1)
+    {
+        len = 1;
+    }
+    if(len > STRESS_MAX_LINE)
+    {
+        len = STRESS_MAX_LINE;
+    }
+    return len;
+}
+
+static void *writer_thread(void *arg)
+{
+    struct stress_thread *thread = (struct stress_thread *)arg;
+    const struct stress_config *config = thread->config;
+    char *line = malloc(STRESS_MAX_LINE);
+    stress_handle handle;
+    size_t i;
+
+    if(line == NULL || !stress_open(config, &handle))
+    {
+        free(line);
+        return NULL;
+    }
+    for(i = 0; i < STRESS_MAX_LINE; i++)
+    {
+        line[i] = (char)('a' + rand_r(&thread->seed) % 26);
+    }
+
+    while(!atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        size_t len = next_line_length(config, &thread->seed);
+        size_t offset = 0;
+        char saved = line[len - 1];
+
+        line[len - 1] = '\n';
+        while(offset < len)
+        {
+            size_t chunk = len - offset;
+            uint64_t start;
+            ssize_t rc;
+
+            if(chunk > 1 && (unsigned int)(rand_r(&thread->seed) % 100) < config->split_percent)
+            {
+                chunk = 1 + (size_t)rand_r(&thread->seed) % (chunk - 1);
+            }
+            start = now_ns();
+            rc = stress_write(handle, line + offset, chunk);
+            hist_record(&thread->hist, now_ns() - start, rc);
+            if(rc <= 0)
+            {
+                break;
+            }
+            offset += (size_t)rc;
+        }
+        line[len - 1] = saved;
+    }
+
+    stress_close(handle);
+    free(line);
+    return NULL;
+}
+
+static void *reader_thread(void *arg)
+{
+    struct stress_thread *thread = (struct stress_thread *)arg;
+    const struct stress_config *config = thread->config;
+    char *buf = malloc(config->read_size);
+    stress_handle handle;
+
+    if(buf == NULL || !stress_open(config, &handle))
+    {
+        free(buf);
+        return NULL;
+    }
+    if(config->filter.type != AESD_FILTER_NONE && !stress_set_filter(handle, &config->filter))
+    {
+        fprintf(stderr, "Could not set the read filter\n");
+        thread->hist.errors++;
+        stress_close(handle);
+        free(buf);
+        return NULL;
+    }
+
+    while(!atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        long long offset = 0;
+
+        // one pass over everything currently stored in the device
+        while(!atomic_load_explicit(&stop, memory_order_relaxed))
+        {
+            uint64_t start = now_ns();
+            ssize_t rc = stress_read(handle, buf, config->read_size, offset);
+
+            hist_record(&thread->hist, now_ns() - start, rc);
+            if(rc <= 0)
+            {
+                break;
+            }
+            offset += rc;
+        }
+    }
+
+    stress_close(handle);
+    free(buf);
+    return NULL;
+}
+
+static void report(const char *op, const struct latency_hist *hist, double seconds)
+{
+    printf("%-6s %10llu %8llu %12.0f %10.2f %9.1f %9.1f %9.1f %9.1f\n", op,
+            (unsigned long long)hist->count, (unsigned long long)hist->errors,
+            hist->count / seconds, hist->bytes / seconds / 1e6,
+            hist_percentile(hist, 50.0) / 1e3, hist_percentile(hist, 99.0) / 1e3,
+            hist_percentile(hist, 99.9) / 1e3, hist->max_ns / 1e3);
+}
+
+static bool parse_line_dist(const char *arg, struct stress_config *config)
+{
+    unsigned long a;
+    unsigned long b;
+
+    if(sscanf(arg, "fixed:%lu", &a) == 1 && a > 0)
+    {
+        config->dist = LINE_FIXED;
+        config->line_min = a;
+        return true;
+    }
+    if(sscanf(arg, "uniform:%lu:%lu", &a, &b) == 2 && a > 0 && b >= a)
+    {
+        config->dist = LINE_UNIFORM;
+        config->line_min = a;
+        config->line_max = b;
+        return true;
+    }
+    if(sscanf(arg, "exp:%lu", &a) == 1 && a > 0)
+    {
+        config->dist = LINE_EXP;
+        config->line_mean = (double)a;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_filter(const char *arg, struct aesd_filter *filter)
+{
+    const char *pattern = NULL;
+    unsigned long long seq;
+
+    memset(filter, 0, sizeof(*filter));
+    if(strncmp(arg, "substr:", 7) == 0)
+    {
+        filter->type = AESD_FILTER_SUBSTRING;
+        pattern = arg + 7;
+    }
+    else if(strncmp(arg, "prefix:", 7) == 0)
+    {
+        filter->type = AESD_FILTER_PREFIX;
+        pattern = arg + 7;
+    }
+    else if(sscanf(arg, "seq:%llu", &seq) == 1)
+    {
+        filter->type = AESD_FILTER_MIN_SEQ;
+        filter->min_seq = seq;
+        return true;
+    }
+    if(pattern == NULL || strlen(pattern) > AESD_FILTER_MAX_PATTERN)
+    {
+        return false;
+    }
+    filter->pattern_len = (uint32_t)strlen(pattern);
+    memcpy(filter->pattern, pattern, filter->pattern_len);
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-w writers] [-r readers] [-d seconds] "
+            "[-l fixed:N|uniform:MIN:MAX|exp:MEAN] [-p split_percent] [-b read_buffer_size] "
+            "[-f substr:TEXT|prefix:TEXT|seq:N] [-o param=value] [device]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct stress_config config = {
+        .device = "/dev/aesdchar",
+        .writers = 2,
+        .readers = 2,
+        .seconds = 5,
+        .dist = LINE_UNIFORM,
+        .line_min = 8,
+        .line_max = 80,
+        .split_percent = 10,
+        .read_size = 4096,
+    };
+    struct stress_thread *threads;
+    struct latency_hist write_hist;
+    struct latency_hist read_hist;
+    uint64_t start;
+    double elapsed;
+    int total;
+    int opt;
+    int i;
+#ifdef AESD_STRESS_SHIM
+    char *value;
+#endif
+
+    while((opt = getopt(argc, argv, "w:r:d:l:p:b:f:o:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'w':
+                config.writers = atoi(optarg);
+                break;
+            case 'r':
+                config.readers = atoi(optarg);
+                break;
+            case 'd':
+                config.seconds = (unsigned int)atoi(optarg);
+                break;
+            case 'l':
+                if(!parse_line_dist(optarg, &config))
+                {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'p':
+                config.split_percent = (unsigned int)atoi(optarg);
+                break;
+            case 'b':
+                config.read_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'f':
+                if(!parse_filter(optarg, &config.filter))
+                {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'o':
+#ifdef AESD_STRESS_SHIM
+                value = strchr(optarg, '=');
+                if(value != NULL)
+                {
+                    *value++ = '\0';
+                }
+                if(value == NULL || aesd_shim_set_param(optarg, value) != 0)
+                {
+                    fprintf(stderr, "Invalid module parameter %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+#else
+                fprintf(stderr, "Module parameters are set when loading the module\n");
+                return EXIT_FAILURE;
+#endif
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(optind < argc)
+    {
+        config.device = argv[optind];
+    }
+    if(config.writers < 0 || config.readers < 0 || config.writers + config.readers == 0
+            || config.read_size == 0 || config.seconds == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+#ifdef AESD_STRESS_SHIM
+    config.device = "<shim>";
+    if(aesd_shim_init() != 0)
+    {
+        fprintf(stderr, "aesd_init_module failed\n");
+        return EXIT_FAILURE;
+    }
+#else
+    {
+        stress_handle handle;
+        if(!stress_open(&config, &handle))
+        {
+            return EXIT_FAILURE;
+        }
+        stress_close(handle);
+    }
+#endif
+
+    total = config.writers + config.readers;
+    threads = calloc(total, sizeof(*threads));
+    if(threads == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    start = now_ns();
+    for(i = 0; i < total; i++)
+    {
+        threads[i].config = &config;
+        threads[i].seed = (unsigned int)(i + 1);
+        if(pthread_create(&threads[i].tid, NULL, i < config.writers ? writer_thread : reader_thread,
+                    &threads[i]) != 0)
+        {
+            fprintf(stderr, "Could not start thread %d\n", i);
+            atomic_store(&stop, true);
+            total = i;
+            break;
+        }
+    }
+
+    sleep(config.seconds);
+    atomic_store(&stop, true);
+    memset(&write_hist, 0, sizeof(write_hist));
+    memset(&read_hist, 0, sizeof(read_hist));
+    for(i = 0; i < total; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        hist_merge(i < config.writers ? &write_hist : &read_hist, &threads[i].hist);
+    }
+    elapsed = (now_ns() - start) / 1e9;
+
+    printf("# %s: %d writers, %d readers, %.1f s, read buffer %zu bytes, %u%% split writes%s\n",
+            config.device, config.writers, config.readers, elapsed, config.read_size, config.split_percent,
+            config.filter.type != AESD_FILTER_NONE ? ", filtered reads" : "");
+    printf("%-6s %10s %8s %12s %10s %9s %9s %9s %9s\n",
+            "op", "calls", "errors", "calls/s", "MB/s", "p50_us", "p99_us", "p999_us", "max_us");
+    report("write", &write_hist, elapsed);
+    report("read", &read_hist, elapsed);
+
+#ifdef AESD_STRESS_SHIM
+    aesd_shim_exit();
+#endif
+    free(threads);
+    return (write_hist.errors == 0 && read_hist.errors == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
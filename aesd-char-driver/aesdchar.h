@@ -9,9 +9,14 @@
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
 #include "linux/mutex.h"
+#include "linux/hashtable.h"
+#include "linux/mempool.h"
 #include "aesd-circular-buffer.h"
+#include "aesd_ioctl.h"
 
+#ifndef AESD_NO_DEBUG
 #define AESD_DEBUG 1  //Remove comment on this line to enable debug
+#endif
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -26,14 +31,102 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/* Buckets of the dedup table, a few per ring slot */
+#define AESD_DEDUP_HASH_BITS 5
+/* Leading bytes of a line hashed for the dedup table */
+#define AESD_DEDUP_HASH_PREFIX 64
+
+/*
+ * Written data is stored in page sized struct aesd_chunk from
+ * aesd-circular-buffer.h, lines as chains of chunks, so no write needs a
+ * contiguous allocation larger than a page, however long the line.  A
+ * chunk's refs count the lines stored in it plus one while the pending data
+ * is, protected by aesd_dev.mutex.  It is freed once neither refer to it.
+ */
+
+#define AESD_CHUNK_SIZE PAGE_SIZE
+#define AESD_CHUNK_DATA (AESD_CHUNK_SIZE - offsetof(struct aesd_chunk, data))
+
+/* Writes up to this size are staged on the stack and need no chunk while they fit in the tail chunk */
+#define AESD_WRITE_STACK_SIZE 128
+
+/**
+ * Storage of a command too long to be kept inline in its ring slot, size
+ * bytes starting at offset in chunk and continuing in the following chunks.
+ * With the dedup module parameter set, slots holding identical commands
+ * share a single aesd_line found through aesd_dev.dedup_table.
+ */
+struct aesd_line
+{
+    struct hlist_node node;
+    u32 hash;
+    /**
+     * Number of ring slots referencing this line, protected by aesd_dev.mutex
+     */
+    unsigned int refs;
+    size_t size;
+    struct aesd_chunk *chunk;
+    size_t offset;
+};
+
+/**
+ * Read position in a line, walking from chunk to chunk
+ */
+struct aesd_cursor
+{
+    /* current chunk, NULL for a line stored inline */
+    struct aesd_chunk *chunk;
+    /* next byte and number of bytes left in the current chunk */
+    const char *data;
+    size_t avail;
+    /* bytes left in the line, including avail */
+    size_t remaining;
+};
+
+/**
+ * Per open file state, referenced by file->private_data
+ */
+struct aesd_file
+{
+    /* set with AESDCHAR_IOCSETFILTER, protected by aesd_dev.mutex */
+    struct aesd_filter filter;
+};
+
+/**
+ * What a write does when neither the kernel nor the reserve can provide memory
+ */
+enum aesd_reserve_policy
+{
+    /* free the oldest line in the ring and retry */
+    AESD_RESERVE_DROP_OLDEST,
+    /* drop the line being written and report the write as done */
+    AESD_RESERVE_DROP_NEWEST,
+    /* fail the write with -EAGAIN */
+    AESD_RESERVE_EAGAIN,
+};
+
 struct aesd_dev
 {
     struct cdev                    cdev;     /* Char device structure      */
     struct mutex                   mutex;
     struct aesd_circular_buffer    circ_buf;
-    unsigned char                  *command_buffer;
-    size_t                         command_buffer_size;
-    size_t                         bytes_in_command_buffer;
+    /* partial line written so far, pending_size bytes from pending_offset in pending_chunk */
+    struct aesd_chunk              *pending_chunk;
+    size_t                         pending_offset;
+    size_t                         pending_size;
+    /* last chunk of the pending chain, new data is appended here */
+    struct aesd_chunk              *tail_chunk;
+    /* set when the start of the pending line was dropped, it is not added to the ring */
+    bool                           drop_pending_line;
+    /* reserves for chunks and lines, see the reserve_chunks module parameter */
+    mempool_t                      *chunk_pool;
+    mempool_t                      *line_pool;
+    enum aesd_reserve_policy       reserve_policy;
+    /* line backing each out of line ring slot, NULL for inline or empty slots */
+    struct aesd_line               *line[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    DECLARE_HASHTABLE(dedup_table, AESD_DEDUP_HASH_BITS);
+    /* number of lines added to the ring so far, the next line's sequence number */
+    u64                            entries_committed;
 };
 
 
@@ -75,5 +75,78 @@ int main(int argc, char **argv)
     assert(strcmp(result->buffptr, "vier") == 0);
     assert(pos == 3);
 
+    // inline entries are copied into the slot, longer ones stay out of line
+    char longline[AESDCHAR_INLINE_ENTRY_SIZE + 2];
+    memset(longline, 'x', sizeof(longline) - 1);
+    longline[sizeof(longline) - 1] = '\0';
+    char shortline[] = "kurz";
+    assert(aesd_circular_buffer_add_inline_entry(&buf, shortline, strlen(shortline) + 1));
+    assert(!aesd_circular_buffer_add_inline_entry(&buf, longline, strlen(longline) + 1));
+    struct aesd_buffer_entry e12 = {.buffptr=longline, .size=strlen(longline) + 1};
+    aesd_circular_buffer_add_entry(&buf, &e12);
+    shortline[0] = 'K';
+
+    result = aesd_circular_buffer_find_entry_offset_for_fpos(&buf, 0, &pos);
+    assert(strcmp(result->buffptr, "vier") == 0);
+    result = &buf.entry[(buf.in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 2) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    assert(aesd_buffer_entry_is_inline(result));
+    assert(strcmp(result->buffptr, "kurz") == 0);
+    result = &buf.entry[(buf.in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    assert(!aesd_buffer_entry_is_inline(result));
+    assert(result->buffptr == longline);
+    assert(sizeof(struct aesd_buffer_entry) % AESD_CACHE_LINE_SIZE == 0);
+    printf("test successful -> inline and out of line entries\n");
+
+    // removing the oldest entries frees slots for new ones without overwriting
+    assert(aesd_circular_buffer_remove_oldest(&buf));
+    assert(aesd_circular_buffer_remove_oldest(&buf));
+    assert(!buf.full);
+    struct aesd_buffer_entry e13 = {.buffptr="dreizehn", .size=9};
+    aesd_circular_buffer_add_entry(&buf, &e13);
+    result = aesd_circular_buffer_find_entry_offset_for_fpos(&buf, 0, &pos);
+    assert(strcmp(result->buffptr, "sechs") == 0);
+    aesd_circular_buffer_add_entry(&buf, &e13);
+    assert(buf.full);
+    aesd_circular_buffer_init(&buf);
+    assert(!aesd_circular_buffer_remove_oldest(&buf));
+    printf("test successful -> remove oldest entries\n");
+
+    // a line stored in three chunks, starting after another line in the first one
+    struct aesd_chunk *chunks[3];
+    const char *chunk_data[3] = {"xyzABCDE", "FGHIJK", "LM\nnext"};
+    for(int i = 2; i >= 0; i--)
+    {
+        chunks[i] = malloc(sizeof(struct aesd_chunk) + strlen(chunk_data[i]));
+        assert(chunks[i] != NULL);
+        chunks[i]->next = i < 2 ? chunks[i + 1] : NULL;
+        chunks[i]->used = strlen(chunk_data[i]);
+        memcpy(chunks[i]->data, chunk_data[i], chunks[i]->used);
+    }
+    aesd_circular_buffer_init(&buf);
+    struct aesd_buffer_entry e14 = {.buffptr="null\n", .size=5};
+    aesd_circular_buffer_add_entry(&buf, &e14);
+    aesd_circular_buffer_add_chunked_entry(&buf, chunks[0], 3, 14);
+    struct aesd_buffer_entry e15 = {.buffptr="nach\n", .size=5};
+    aesd_circular_buffer_add_entry(&buf, &e15);
+
+    result = aesd_circular_buffer_find_entry_offset_for_fpos(&buf, 5 + 7, &pos);
+    assert(result->buffptr == chunks[1]->data && result->size == 6 && pos == 2);
+    result = aesd_circular_buffer_find_entry_offset_for_fpos(&buf, 5 + 13, &pos);
+    assert(result->buffptr == chunks[2]->data && result->size == 3 && pos == 2);
+    // read everything back the way a driver's read() walks the buffer
+    char testresult4[100] = {0};
+    size_t fpos = 0;
+    while((result = aesd_circular_buffer_find_entry_offset_for_fpos(&buf, fpos, &pos)) != NULL)
+    {
+        strncat(testresult4, result->buffptr + pos, result->size - pos);
+        fpos += result->size - pos;
+    }
+    assert(strcmp(testresult4, "null\nABCDEFGHIJKLM\nnach\n") == 0);
+    for(int i = 0; i < 3; i++)
+    {
+        free(chunks[i]);
+    }
+    printf("test successful -> entries stored in chunks\n");
+
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -17,42 +17,730 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/slab.h>
+#include <linux/mm.h> // PAGE_SIZE
+#include <linux/jhash.h>
+#include <linux/mempool.h>
+#include <linux/moduleparam.h>
 #include "aesdchar.h"
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+static bool dedup = false;
+module_param(dedup, bool, S_IRUGO);
+MODULE_PARM_DESC(dedup, "Share the storage of identical commands between ring slots");
+
+static unsigned long dedup_hits = 0;
+module_param(dedup_hits, ulong, S_IRUGO);
+MODULE_PARM_DESC(dedup_hits, "Number of commands stored by referencing an identical line");
+
+static unsigned int reserve_chunks = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(reserve_chunks, uint, S_IRUGO);
+MODULE_PARM_DESC(reserve_chunks, "Chunks kept in reserve for writes under memory pressure, at least one");
+
+static char *reserve_policy = "drop_oldest";
+module_param(reserve_policy, charp, S_IRUGO);
+MODULE_PARM_DESC(reserve_policy, "When the reserve is empty: drop_oldest line, drop_newest line or eagain");
+
+static unsigned long reserve_used = 0;
+module_param(reserve_used, ulong, S_IRUGO);
+MODULE_PARM_DESC(reserve_used, "Number of allocations served from the reserve");
+
+static unsigned long reserve_exhausted = 0;
+module_param(reserve_exhausted, ulong, S_IRUGO);
+MODULE_PARM_DESC(reserve_exhausted, "Number of times reserve_policy was applied");
+
+static unsigned long reserve_dropped_lines = 0;
+module_param(reserve_dropped_lines, ulong, S_IRUGO);
+MODULE_PARM_DESC(reserve_dropped_lines, "Number of lines dropped by reserve_policy");
+
 MODULE_AUTHOR("Robert Eichinger");
 MODULE_LICENSE("Dual BSD/GPL");
 
 struct aesd_dev aesd_device;
 
+/**
+ * Element allocator of the reserves, @param pool_data is the element size.
+ * It only allocates when @param gfp may sleep, as when mempool_create() fills
+ * the pool: aesd_reserve_alloc() calls mempool_alloc() without sleeping, so
+ * that only ever returns elements held in reserve.
+ */
+static void *aesd_pool_alloc(gfp_t gfp, void *pool_data)
+{
+    if(!gfpflags_allow_blocking(gfp))
+    {
+        return NULL;
+    }
+    return kmalloc((size_t)pool_data, gfp);
+}
+
+/**
+ * Allocate from @param pool, trying the kernel first and the reserve only if
+ * no memory is available without waiting.  @param gfp must not sleep while
+ * the device mutex is held.
+ * @param from_reserve is incremented if the element came from the reserve
+ */
+static void *aesd_reserve_alloc(mempool_t *pool, size_t size, gfp_t gfp, unsigned int *from_reserve)
+{
+    void *element = kmalloc(size, gfp | __GFP_NOWARN);
+
+    if(element == NULL)
+    {
+        element = mempool_alloc(pool, GFP_NOWAIT | __GFP_NOWARN);
+        if(element != NULL)
+        {
+            (*from_reserve)++;
+        }
+    }
+    return element;
+}
+
+/**
+ * Allocate an empty chunk holding one reference for the caller
+ */
+static struct aesd_chunk *aesd_chunk_alloc(gfp_t gfp, unsigned int *from_reserve)
+{
+    struct aesd_chunk *chunk = aesd_reserve_alloc(aesd_device.chunk_pool, AESD_CHUNK_SIZE, gfp, from_reserve);
+
+    if(chunk != NULL)
+    {
+        chunk->next = NULL;
+        chunk->refs = 1;
+        chunk->used = 0;
+    }
+    return chunk;
+}
+
+static void aesd_chunk_put(struct aesd_chunk *chunk)
+{
+    if(--chunk->refs == 0)
+    {
+        mempool_free(chunk, aesd_device.chunk_pool);
+    }
+}
+
+/**
+ * Free a chain of chunks which was never added to the device
+ */
+static void aesd_chunk_free_chain(struct aesd_chunk *chunk)
+{
+    while(chunk != NULL)
+    {
+        struct aesd_chunk *next = chunk->next;
+
+        mempool_free(chunk, aesd_device.chunk_pool);
+        chunk = next;
+    }
+}
+
+/**
+ * Position @param cursor at the start of the @param size bytes stored from
+ * @param offset in the chain starting at @param chunk
+ */
+static void aesd_cursor_init_chunk(struct aesd_cursor *cursor, struct aesd_chunk *chunk, size_t offset,
+        size_t size)
+{
+    cursor->chunk = chunk;
+    cursor->data = chunk->data + offset;
+    cursor->avail = chunk->used - offset;
+    if(cursor->avail > size)
+    {
+        cursor->avail = size;
+    }
+    cursor->remaining = size;
+}
+
+/**
+ * Position @param cursor at the start of the contents of ring slot @param index
+ */
+static void aesd_cursor_init_entry(struct aesd_cursor *cursor, uint8_t index)
+{
+    const struct aesd_line *line = aesd_device.line[index];
+    const struct aesd_buffer_entry *entry = &aesd_device.circ_buf.entry[index];
+
+    if(line != NULL)
+    {
+        aesd_cursor_init_chunk(cursor, line->chunk, line->offset, line->size);
+        return;
+    }
+    cursor->chunk = NULL;
+    cursor->data = entry->buffptr;
+    cursor->avail = entry->size;
+    cursor->remaining = entry->size;
+}
+
+static void aesd_cursor_advance(struct aesd_cursor *cursor, size_t bytes)
+{
+    while(bytes > 0 && cursor->remaining > 0)
+    {
+        size_t step = bytes < cursor->avail ? bytes : cursor->avail;
+
+        cursor->data += step;
+        cursor->avail -= step;
+        cursor->remaining -= step;
+        bytes -= step;
+        if(cursor->avail == 0 && cursor->remaining > 0)
+        {
+            cursor->chunk = cursor->chunk->next;
+            cursor->data = cursor->chunk->data;
+            cursor->avail = cursor->chunk->used < cursor->remaining ? cursor->chunk->used : cursor->remaining;
+        }
+    }
+}
+
+/**
+ * Copy up to @param size bytes at @param cursor to @param buf and advance it
+ * @return the number of bytes copied
+ */
+static size_t aesd_cursor_copy(struct aesd_cursor *cursor, char *buf, size_t size)
+{
+    size_t copied = 0;
+
+    while(copied < size && cursor->remaining > 0)
+    {
+        size_t step = size - copied < cursor->avail ? size - copied : cursor->avail;
+
+        memcpy(buf + copied, cursor->data, step);
+        copied += step;
+        aesd_cursor_advance(cursor, step);
+    }
+    return copied;
+}
+
+/**
+ * @return true if the bytes at @param cursor start with the @param len bytes at @param data
+ */
+static bool aesd_cursor_starts_with(const struct aesd_cursor *cursor, const char *data, size_t len)
+{
+    struct aesd_cursor pos = *cursor;
+
+    if(pos.remaining < len)
+    {
+        return false;
+    }
+    while(len > 0)
+    {
+        size_t step = len < pos.avail ? len : pos.avail;
+
+        if(memcmp(pos.data, data, step) != 0)
+        {
+            return false;
+        }
+        data += step;
+        len -= step;
+        aesd_cursor_advance(&pos, step);
+    }
+    return true;
+}
+
+/**
+ * @return true if the @param len bytes at @param pattern occur in the bytes at @param cursor
+ */
+static bool aesd_cursor_contains(struct aesd_cursor *cursor, const char *pattern, size_t len)
+{
+    if(len == 0)
+    {
+        return true;
+    }
+    while(cursor->remaining >= len)
+    {
+        const char *hit = memchr(cursor->data, pattern[0], cursor->avail);
+
+        if(hit == NULL)
+        {
+            aesd_cursor_advance(cursor, cursor->avail);
+            continue;
+        }
+        aesd_cursor_advance(cursor, hit - cursor->data);
+        if(aesd_cursor_starts_with(cursor, pattern, len))
+        {
+            return true;
+        }
+        aesd_cursor_advance(cursor, 1);
+    }
+    return false;
+}
+
+/**
+ * @return true if the bytes remaining at @param a and @param b are identical
+ */
+static bool aesd_cursors_equal(struct aesd_cursor *a, struct aesd_cursor *b)
+{
+    if(a->remaining != b->remaining)
+    {
+        return false;
+    }
+    while(a->remaining > 0)
+    {
+        size_t step = a->avail < b->avail ? a->avail : b->avail;
+
+        if(memcmp(a->data, b->data, step) != 0)
+        {
+            return false;
+        }
+        aesd_cursor_advance(a, step);
+        aesd_cursor_advance(b, step);
+    }
+    return true;
+}
+
+/**
+ * Get a line for the @param size bytes of the pending chain, either a new
+ * one referencing the chunks they are stored in or, in dedup mode, an
+ * existing line with the same contents.  Called with the device mutex held.
+ * @return the line with a reference taken for the caller, NULL if out of memory
+ */
+static struct aesd_line *aesd_line_get(size_t size)
+{
+    struct aesd_line *line;
+    struct aesd_cursor pending;
+    struct aesd_chunk *chunk;
+    size_t covered;
+    u32 hash = 0;
+
+    aesd_cursor_init_chunk(&pending, aesd_device.pending_chunk, aesd_device.pending_offset, size);
+    if(dedup)
+    {
+        // hash the start of the line only, so long lines cost no more than short ones
+        char prefix[AESD_DEDUP_HASH_PREFIX];
+        struct aesd_cursor pos = pending;
+        size_t prefix_len = aesd_cursor_copy(&pos, prefix, sizeof(prefix));
+
+        hash = jhash(prefix, prefix_len, (u32)size);
+        hash_for_each_possible(aesd_device.dedup_table, line, node, hash)
+        {
+            struct aesd_cursor existing;
+
+            pos = pending;
+            aesd_cursor_init_chunk(&existing, line->chunk, line->offset, line->size);
+            if(line->hash == hash && aesd_cursors_equal(&existing, &pos))
+            {
+                line->refs++;
+                dedup_hits++;
+                return line;
+            }
+        }
+    }
+
+    {
+        unsigned int from_reserve = 0;
+
+        // the line pool holds one line per ring slot and one more, this never waits nor fails
+        line = aesd_reserve_alloc(aesd_device.line_pool, sizeof(*line), GFP_NOWAIT, &from_reserve);
+        if(line == NULL)
+        {
+            return NULL;
+        }
+        reserve_used += from_reserve;
+    }
+    line->chunk = aesd_device.pending_chunk;
+    line->offset = aesd_device.pending_offset;
+    line->size = size;
+    line->hash = hash;
+    line->refs = 1;
+    covered = line->chunk->used - line->offset;
+    for(chunk = line->chunk; ; chunk = chunk->next)
+    {
+        chunk->refs++;
+        if(covered >= size)
+        {
+            break;
+        }
+        covered += chunk->next->used;
+    }
+    if(dedup)
+    {
+        hash_add(aesd_device.dedup_table, &line->node, hash);
+    }
+    return line;
+}
+
+/**
+ * Drop a reference to @param line, releasing it and its chunks with the last one
+ */
+static void aesd_line_put(struct aesd_line *line)
+{
+    struct aesd_chunk *chunk;
+    size_t covered;
+
+    if(--line->refs > 0)
+    {
+        return;
+    }
+    if(dedup)
+    {
+        hash_del(&line->node);
+    }
+    chunk = line->chunk;
+    covered = chunk->used - line->offset;
+    for(;;)
+    {
+        struct aesd_chunk *next = chunk->next;
+
+        aesd_chunk_put(chunk);
+        if(covered >= line->size)
+        {
+            break;
+        }
+        covered += next->used;
+        chunk = next;
+    }
+    mempool_free(line, aesd_device.line_pool);
+}
+
+/**
+ * Release the storage of ring slot @param index before it is reused or freed
+ */
+static void aesd_free_entry(uint8_t index)
+{
+    if(aesd_device.line[index] != NULL)
+    {
+        aesd_line_put(aesd_device.line[index]);
+        aesd_device.line[index] = NULL;
+    }
+    aesd_device.circ_buf.entry[index].buffptr = NULL;
+    aesd_device.circ_buf.chunk[index] = NULL;
+}
+
+/**
+ * Drop the pending references of every chunk before the tail chunk, once the
+ * pending line restarts in the tail chunk
+ */
+static void aesd_release_pending_chain(void)
+{
+    struct aesd_chunk *chunk = aesd_device.pending_chunk;
+
+    while(chunk != aesd_device.tail_chunk)
+    {
+        struct aesd_chunk *next = chunk->next;
+
+        aesd_chunk_put(chunk);
+        chunk = next;
+    }
+    aesd_device.pending_chunk = aesd_device.tail_chunk;
+}
+
+/**
+ * Add the first @param size bytes of the pending chain as a new line to the
+ * ring.  The rest of the pending chain starts at @param next_offset in the
+ * tail chunk.  Called with the device mutex held.
+ * @return 0 or -ENOMEM, in which case the line is dropped
+ */
+static int aesd_commit_line(size_t size, size_t next_offset)
+{
+    uint8_t slot = aesd_device.circ_buf.in_offs;
+    struct aesd_line *line;
+    int result = 0;
+
+    if(aesd_device.drop_pending_line)
+    {
+        // the start of this line was lost to reserve_policy
+        aesd_device.drop_pending_line = false;
+    }
+    else if(size <= AESDCHAR_INLINE_ENTRY_SIZE)
+    {
+        // short commands are copied straight into the ring slot
+        char command[AESDCHAR_INLINE_ENTRY_SIZE];
+        struct aesd_cursor pending;
+
+        aesd_cursor_init_chunk(&pending, aesd_device.pending_chunk, aesd_device.pending_offset, size);
+        aesd_cursor_copy(&pending, command, size);
+        if(aesd_device.circ_buf.full)
+        {
+            aesd_free_entry(slot);
+        }
+        aesd_circular_buffer_add_inline_entry(&aesd_device.circ_buf, command, size);
+        aesd_device.entries_committed++;
+    }
+    else
+    {
+        // take the reference before releasing the old entry, which may hold the same line
+        line = aesd_line_get(size);
+        if(line == NULL)
+        {
+            PDEBUG("Allocation of line failed");
+            result = -ENOMEM;
+        }
+        else
+        {
+            if(aesd_device.circ_buf.full)
+            {
+                aesd_free_entry(slot);
+            }
+            aesd_device.line[slot] = line;
+            aesd_circular_buffer_add_chunked_entry(&aesd_device.circ_buf, line->chunk, line->offset, size);
+            aesd_device.entries_committed++;
+        }
+    }
+
+    aesd_release_pending_chain();
+    aesd_device.pending_offset = next_offset;
+    aesd_device.pending_size = 0;
+    return result;
+}
+
+/**
+ * Make @param chunk, filled with new data, the tail of the pending chain.
+ * Called with the device mutex held.
+ */
+static void aesd_append_chunk(struct aesd_chunk *chunk)
+{
+    if(aesd_device.tail_chunk != NULL && aesd_device.pending_size > 0)
+    {
+        // the pending line continues in the new chunk
+        aesd_device.tail_chunk->next = chunk;
+    }
+    else
+    {
+        if(aesd_device.tail_chunk != NULL)
+        {
+            aesd_chunk_put(aesd_device.tail_chunk);
+        }
+        aesd_device.pending_chunk = chunk;
+        aesd_device.pending_offset = 0;
+    }
+    aesd_device.tail_chunk = chunk;
+}
+
+/**
+ * Commit every line completed by the data added to the tail chunk from
+ * @param start.  A line which cannot be committed is counted in
+ * reserve_dropped_lines, its bytes are consumed all the same.  Called with
+ * the device mutex held.
+ */
+static void aesd_scan_tail(size_t start)
+{
+    struct aesd_chunk *tail = aesd_device.tail_chunk;
+    const char *newline;
+
+    while((newline = memchr(tail->data + start, '\n', tail->used - start)) != NULL)
+    {
+        size_t end = newline - tail->data + 1;
+
+        aesd_device.pending_size += end - start;
+        start = end;
+        if(aesd_commit_line(aesd_device.pending_size, end) != 0)
+        {
+            reserve_dropped_lines++;
+        }
+    }
+    aesd_device.pending_size += tail->used - start;
+}
+
+/**
+ * @return the bytes left in the tail chunk, 0 if there is none.  Called with
+ * the device mutex held.
+ */
+static size_t aesd_tail_space(void)
+{
+    if(aesd_device.tail_chunk == NULL)
+    {
+        return 0;
+    }
+    return AESD_CHUNK_DATA - aesd_device.tail_chunk->used;
+}
+
+/**
+ * Append the @param size bytes at @param data, which must fit, to the tail
+ * chunk and commit the lines they complete.  Called with the device mutex held.
+ */
+static void aesd_append_tail(const char *data, size_t size)
+{
+    struct aesd_chunk *tail = aesd_device.tail_chunk;
+    size_t start = tail->used;
+
+    memcpy(tail->data + start, data, size);
+    tail->used += size;
+    aesd_scan_tail(start);
+}
+
+/**
+ * Copy as much of the @param count bytes at @param buf as fits straight
+ * into the tail chunk, for writes which could not get a new chunk.  Unlike
+ * the normal write path this copies from userspace with the mutex held, it
+ * is only taken under memory pressure.
+ * @return the bytes written, 0 if the tail chunk is full or a negative error
+ */
+static ssize_t aesd_write_tail(const char __user *buf, size_t count)
+{
+    struct aesd_chunk *tail;
+    size_t space;
+    size_t start;
+    size_t copied;
+
+    if(mutex_lock_interruptible(&aesd_device.mutex))
+    {
+        return -ERESTARTSYS;
+    }
+    space = aesd_tail_space();
+    if(space == 0)
+    {
+        mutex_unlock(&aesd_device.mutex);
+        return 0;
+    }
+    if(space > count)
+    {
+        space = count;
+    }
+    tail = aesd_device.tail_chunk;
+    start = tail->used;
+    copied = space - copy_from_user(tail->data + start, buf, space);
+    tail->used += copied;
+    aesd_scan_tail(start);
+    mutex_unlock(&aesd_device.mutex);
+
+    if(copied == 0)
+    {
+        return -EFAULT;
+    }
+    return (ssize_t)copied;
+}
+
+/**
+ * @return the number of lines currently held by the ring
+ */
+static uint8_t aesd_entries_stored(void)
+{
+    const struct aesd_circular_buffer *buffer = &aesd_device.circ_buf;
+
+    if(buffer->full)
+    {
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs)
+        % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+ * @return true if releasing ring slot @param index returns a chunk to the
+ * pool, which neither an inline entry nor a line still shared through dedup
+ * or with its neighbours in the same chunk does.  Called with the device
+ * mutex held.
+ */
+static bool aesd_entry_frees_chunk(uint8_t index)
+{
+    const struct aesd_line *line = aesd_device.line[index];
+    const struct aesd_chunk *chunk;
+    size_t covered;
+
+    if(line == NULL || line->refs > 1)
+    {
+        return false;
+    }
+    chunk = line->chunk;
+    covered = chunk->used - line->offset;
+    for(;;)
+    {
+        if(chunk->refs == 1)
+        {
+            return true;
+        }
+        if(covered >= line->size)
+        {
+            return false;
+        }
+        chunk = chunk->next;
+        covered += chunk->used;
+    }
+}
+
+/**
+ * Apply reserve_policy after the reserve ran out while preparing a write
+ * ending with @param last.
+ * @return 0 to retry the allocation, 1 if the write was dropped or a negative error
+ */
+static int aesd_reserve_exhausted(char last)
+{
+    int result = -ENOMEM;
+
+    if(mutex_lock_interruptible(&aesd_device.mutex))
+    {
+        return -ERESTARTSYS;
+    }
+    reserve_exhausted++;
+    switch(aesd_device.reserve_policy)
+    {
+        case AESD_RESERVE_DROP_OLDEST:
+            // free the oldest line if that returns a chunk to the reserve, dropping a line
+            // which frees nothing would only empty the ring before failing all the same
+            if(aesd_entries_stored() > 0 && aesd_entry_frees_chunk(aesd_device.circ_buf.out_offs))
+            {
+                aesd_free_entry(aesd_device.circ_buf.out_offs);
+                aesd_circular_buffer_remove_oldest(&aesd_device.circ_buf);
+                reserve_dropped_lines++;
+                result = 0;
+            }
+            break;
+        case AESD_RESERVE_DROP_NEWEST:
+            // drop the pending line and this write, up to the end of the line it leaves open
+            aesd_release_pending_chain();
+            aesd_device.pending_offset = aesd_device.tail_chunk != NULL ? aesd_device.tail_chunk->used : 0;
+            aesd_device.pending_size = 0;
+            reserve_dropped_lines++;
+            aesd_device.drop_pending_line = (last != '\n');
+            result = 1;
+            break;
+        default:
+            result = -EAGAIN;
+            break;
+    }
+    mutex_unlock(&aesd_device.mutex);
+    return result;
+}
+
 int aesd_open(struct inode *inode, struct file *filp)
 {
+    struct aesd_file *file;
+
     PDEBUG("open");
-    /**
-     * TODO: handle open
-     */
+    file = kmalloc(sizeof(*file), GFP_KERNEL);
+    if(file == NULL)
+    {
+        return -ENOMEM;
+    }
+    memset(file, 0, sizeof(*file));
+    file->filter.type = AESD_FILTER_NONE;
+    filp->private_data = file;
     return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp)
 {
     PDEBUG("release");
-    /**
-     * TODO: handle release
-     */
+    kfree(filp->private_data);
+    filp->private_data = NULL;
     return 0;
 }
 
+/**
+ * @return true if the line at @param cursor with sequence number @param seq passes @param filter
+ */
+static bool aesd_filter_matches(const struct aesd_filter *filter, const struct aesd_cursor *cursor, u64 seq)
+{
+    struct aesd_cursor pos = *cursor;
+
+    switch(filter->type)
+    {
+        case AESD_FILTER_SUBSTRING:
+            return aesd_cursor_contains(&pos, filter->pattern, filter->pattern_len);
+        case AESD_FILTER_PREFIX:
+            return aesd_cursor_starts_with(&pos, filter->pattern, filter->pattern_len);
+        case AESD_FILTER_MIN_SEQ:
+            return seq >= filter->min_seq;
+        default:
+            return true;
+    }
+}
+
 ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
                 loff_t *f_pos)
 {
-    ssize_t retval = 0;
-    uint8_t out_index = aesd_device.circ_buf.out_offs;
-    uint8_t entry_count = 0;
-    size_t bytes_remaining = count;
-    size_t bytes_skipped = 0;
+    const struct aesd_file *file = filp->private_data;
     size_t bytes_copied = 0;
+    loff_t bytes_to_skip = *f_pos;
+    uint8_t stored;
+    uint8_t n;
+    u64 seq;
 
     PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
     
@@ -61,187 +749,218 @@ ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
         return -ERESTARTSYS;
     }
 
-    while((aesd_device.circ_buf.entry[out_index].buffptr != NULL) 
-            && (entry_count < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED))
+    // the file position counts bytes of the lines passing the filter only
+    stored = aesd_entries_stored();
+    seq = aesd_device.entries_committed - stored;
+    for(n = 0; n < stored && bytes_copied < count; n++, seq++)
     {
-        size_t bytes_to_copy = aesd_device.circ_buf.entry[out_index].size;
-        size_t bytes_not_copied;
+        struct aesd_cursor cursor;
 
-        if(bytes_remaining < bytes_to_copy)
+        aesd_cursor_init_entry(&cursor, (aesd_device.circ_buf.out_offs + n) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+        if(!aesd_filter_matches(&file->filter, &cursor, seq))
         {
-            bytes_to_copy = bytes_remaining;
+            continue;
         }
-        
-        if(bytes_skipped < *f_pos)
+        if(bytes_to_skip >= cursor.remaining)
         {
-            bytes_skipped += aesd_device.circ_buf.entry[out_index].size;
+            bytes_to_skip -= cursor.remaining;
+            continue;
         }
-        else
-        {
-            // for debugging only
-            #if 0
-                char buffer[100] = {0};
-                memcpy(buffer, aesd_device.circ_buf.entry[out_index].buffptr, aesd_device.circ_buf.entry[out_index].size);
-                PDEBUG("Processing entry %s", buffer);
-            #endif
 
-            bytes_not_copied = copy_to_user(&buf[bytes_copied], aesd_device.circ_buf.entry[out_index].buffptr, bytes_to_copy);
+        // long lines are copied straight from the chunks they are stored in
+        aesd_cursor_advance(&cursor, bytes_to_skip);
+        bytes_to_skip = 0;
+        while(cursor.remaining > 0 && bytes_copied < count)
+        {
+            size_t bytes_to_copy = cursor.avail;
 
-            if(bytes_not_copied)
+            if(bytes_to_copy > count - bytes_copied)
             {
-                mutex_unlock(&aesd_device.mutex);
-                return -ERESTARTSYS;
+                bytes_to_copy = count - bytes_copied;
             }
-
-            bytes_remaining -= bytes_to_copy;
-            bytes_copied += bytes_to_copy;
-
-            if(bytes_remaining == 0)
+            if(copy_to_user(&buf[bytes_copied], cursor.data, bytes_to_copy))
             {
-                break;
+                mutex_unlock(&aesd_device.mutex);
+                return -EFAULT;
             }
+            bytes_copied += bytes_to_copy;
+            aesd_cursor_advance(&cursor, bytes_to_copy);
         }
-
-        out_index++;
-        out_index %= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        entry_count++;
     }
 
-    retval = bytes_copied;
     *f_pos += bytes_copied;
     
     mutex_unlock(&aesd_device.mutex);
-    return retval;
+    return bytes_copied;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    ssize_t retval = -ENOMEM;
-    size_t  uncopied = 0;
-    unsigned int last_newline_index;
-    unsigned int i;
-    unsigned int command_start_index = 0;
-    bool newline_in_buffer = false;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_filter filter;
 
-    PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
-    
-    if(mutex_lock_interruptible(&aesd_device.mutex))
+    if(_IOC_TYPE(cmd) != AESD_IOC_MAGIC || _IOC_NR(cmd) > AESDCHAR_IOC_MAXNR)
     {
-        return -ERESTARTSYS;
-    }
-
-    if(aesd_device.command_buffer == NULL)
-    {
-        PDEBUG("Initializing the command buffer with 100 bytes");
-        aesd_device.command_buffer = kmalloc(100, GFP_KERNEL); 
-        aesd_device.command_buffer_size = 100;
+        return -ENOTTY;
     }
 
-    if((count + aesd_device.bytes_in_command_buffer) > aesd_device.command_buffer_size)
-    {
-        PDEBUG("Command buffer size will be exceeded, doubling the memory...");
-        aesd_device.command_buffer_size *= 2;
-        aesd_device.command_buffer = krealloc(aesd_device.command_buffer, aesd_device.command_buffer_size, GFP_KERNEL);
-    }
-    
-    if(aesd_device.command_buffer == NULL)
+    switch(cmd)
     {
-        mutex_unlock(&aesd_device.mutex);
-        PDEBUG("Allocation failed");
-        return -ENOMEM;
+        case AESDCHAR_IOCSETFILTER:
+            if(copy_from_user(&filter, (const void __user *)arg, sizeof(filter)))
+            {
+                return -EFAULT;
+            }
+            if(filter.type > AESD_FILTER_MIN_SEQ || filter.pattern_len > AESD_FILTER_MAX_PATTERN)
+            {
+                return -EINVAL;
+            }
+            PDEBUG("set filter type %u", filter.type);
+            if(mutex_lock_interruptible(&aesd_device.mutex))
+            {
+                return -ERESTARTSYS;
+            }
+            file->filter = filter;
+            filp->f_pos = 0;
+            mutex_unlock(&aesd_device.mutex);
+            return 0;
+        default:
+            return -ENOTTY;
     }
+}
 
-    PDEBUG("Writing to command buffer index %ld", aesd_device.bytes_in_command_buffer);
+ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
+                loff_t *f_pos)
+{
+    struct aesd_chunk *staged = NULL;
+    struct aesd_chunk **link = &staged;
+    unsigned int from_reserve = 0;
+    size_t written = 0;
+    ssize_t tail_written;
+    int result = 0;
 
-    // for debugging only
-    #if 0
-        char tmp_buf[100] = {0};
-        memcpy(tmp_buf, buf, count);
-        PDEBUG("Receiving buffer from user %s", tmp_buf);
-        PDEBUG("Number of bytes in buffer before copying: %lu", aesd_device.bytes_in_command_buffer);
-    #endif
+    PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
 
-    uncopied = copy_from_user(&aesd_device.command_buffer[aesd_device.bytes_in_command_buffer], buf, count);
-    if(uncopied != 0)
+    if(count == 0)
     {
-        PDEBUG("Not all bytes could be copied from userspace");
+        return 0;
     }
 
-    aesd_device.bytes_in_command_buffer += (count - uncopied);
-    retval = (count - uncopied);
-
-    for(i= 0; i < aesd_device.bytes_in_command_buffer;i++)
+    if(count <= AESD_WRITE_STACK_SIZE)
     {
-        if(aesd_device.command_buffer[i] == '\n')
+        // a small write which fits in the tail chunk needs no allocation at all
+        char data[AESD_WRITE_STACK_SIZE];
+
+        if(copy_from_user(data, buf, count) == 0)
         {
-            size_t command_len = i + 1 - command_start_index;
-            char *command_buf = kmalloc(command_len, GFP_KERNEL);
-            struct aesd_buffer_entry entry;
-            last_newline_index = i;
-            newline_in_buffer = true;
-            if(command_buf == NULL)
+            if(mutex_lock_interruptible(&aesd_device.mutex))
             {
-                PDEBUG("Allocation of command buffer failed");
-                mutex_unlock(&aesd_device.mutex);
-                return -ENOMEM;
+                return -ERESTARTSYS;
             }
-            memcpy(command_buf, &aesd_device.command_buffer[command_start_index], command_len);
-            // for debugging only
-            #if 0
-                char buffer[100] = {0};
-                memcpy(buffer, command_buf, command_len);
-                PDEBUG("Processed command: %s", buffer);
-            #endif
-            // free the old entry in the ringbuffer
-            if(aesd_device.circ_buf.full)
+            if(count <= aesd_tail_space())
             {
-                // This should not be done here
-                kfree(aesd_device.circ_buf.entry[aesd_device.circ_buf.in_offs].buffptr);
+                aesd_append_tail(data, count);
+                mutex_unlock(&aesd_device.mutex);
+                return (ssize_t)count;
             }
-            entry.buffptr = command_buf;
-            entry.size = command_len;
-            aesd_circular_buffer_add_entry(&aesd_device.circ_buf, &entry);
-            command_start_index = i + 1;
+            mutex_unlock(&aesd_device.mutex);
         }
     }
 
-    if(newline_in_buffer)
+    // allocate and fill the chunks for the new data before taking the mutex,
+    // so neither reclaim nor page faults on buf stall readers
+    while(written < count)
     {
-        int idx = 0;
-        last_newline_index++;
-        while(last_newline_index < aesd_device.bytes_in_command_buffer)
+        struct aesd_chunk *chunk = aesd_chunk_alloc(GFP_KERNEL | __GFP_NORETRY, &from_reserve);
+        size_t space = count - written;
+        size_t uncopied;
+
+        if(chunk == NULL)
         {
-            aesd_device.command_buffer[idx] = aesd_device.command_buffer[last_newline_index++];
-            idx++;
+            char last = '\n';
+
+            if(written > 0)
+            {
+                // keep what fits, the caller retries the rest
+                break;
+            }
+            // reserve_policy only applies once the tail chunk has no room left either
+            tail_written = aesd_write_tail(buf, count);
+            if(tail_written != 0)
+            {
+                return tail_written;
+            }
+            if(copy_from_user(&last, &buf[count - 1], 1))
+            {
+                return -EFAULT;
+            }
+            result = aesd_reserve_exhausted(last);
+            if(result == 0)
+            {
+                continue;
+            }
+            PDEBUG("Reserve exhausted, write %s", result > 0 ? "dropped" : "failed");
+            return result > 0 ? (ssize_t)count : result;
+        }
+
+        if(space > AESD_CHUNK_DATA)
+        {
+            space = AESD_CHUNK_DATA;
+        }
+        uncopied = copy_from_user(chunk->data, &buf[written], space);
+        chunk->used = space - uncopied;
+        written += chunk->used;
+        *link = chunk;
+        link = &chunk->next;
+        if(uncopied != 0)
+        {
+            PDEBUG("Not all bytes could be copied from userspace");
+            break;
         }
-        aesd_device.bytes_in_command_buffer = idx;
     }
 
-    // for debugging only
-    #if 0
-    int index = 0;
-    struct aesd_buffer_entry *e;
-    PDEBUG("DEBUG BUFFER");
-    AESD_CIRCULAR_BUFFER_FOREACH(e, &aesd_device.circ_buf, index)
+    if(written == 0)
     {
-        if(e->buffptr !=NULL)
+        aesd_chunk_free_chain(staged);
+        return -EFAULT;
+    }
+
+    if(mutex_lock_interruptible(&aesd_device.mutex))
+    {
+        aesd_chunk_free_chain(staged);
+        return -ERESTARTSYS;
+    }
+    reserve_used += from_reserve;
+
+    if(staged->next == NULL && staged->used <= aesd_tail_space())
+    {
+        // small writes are gathered in the tail chunk, the staged chunk is freed below
+        aesd_append_tail(staged->data, staged->used);
+    }
+    else
+    {
+        while(staged != NULL)
         {
-            char buffer[100] = {0};
-            memcpy(buffer, e->buffptr, e->size);
-            PDEBUG("entry: %s", buffer);
+            struct aesd_chunk *chunk = staged;
+
+            staged = chunk->next;
+            chunk->next = NULL;
+            aesd_append_chunk(chunk);
+            aesd_scan_tail(0);
         }
     }
-    #endif
 
     mutex_unlock(&aesd_device.mutex);
+    aesd_chunk_free_chain(staged);
 
-    return retval;
+    // every staged byte is consumed, lines which could not be committed are counted in reserve_dropped_lines
+    return (ssize_t)written;
 }
 struct file_operations aesd_fops = {
     .owner =    THIS_MODULE,
     .read =     aesd_read,
     .write =    aesd_write,
+    .unlocked_ioctl = aesd_unlocked_ioctl,
     .open =     aesd_open,
     .release =  aesd_release,
 };
@@ -275,15 +994,46 @@ int aesd_init_module(void)
     }
     memset(&aesd_device,0,sizeof(struct aesd_dev));
 
+    if(strcmp(reserve_policy, "drop_oldest") == 0)
+    {
+        aesd_device.reserve_policy = AESD_RESERVE_DROP_OLDEST;
+    }
+    else if(strcmp(reserve_policy, "drop_newest") == 0)
+    {
+        aesd_device.reserve_policy = AESD_RESERVE_DROP_NEWEST;
+    }
+    else if(strcmp(reserve_policy, "eagain") == 0)
+    {
+        aesd_device.reserve_policy = AESD_RESERVE_EAGAIN;
+    }
+    else
+    {
+        printk(KERN_WARNING "Unknown reserve_policy %s\n", reserve_policy);
+        unregister_chrdev_region(dev, 1);
+        return -EINVAL;
+    }
+
+    aesd_device.chunk_pool = mempool_create(reserve_chunks > 0 ? reserve_chunks : 1, aesd_pool_alloc,
+            mempool_kfree, (void *)AESD_CHUNK_SIZE);
+    aesd_device.line_pool = mempool_create(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 1, aesd_pool_alloc,
+            mempool_kfree, (void *)sizeof(struct aesd_line));
+    if(aesd_device.chunk_pool == NULL || aesd_device.line_pool == NULL)
+    {
+        mempool_destroy(aesd_device.chunk_pool);
+        mempool_destroy(aesd_device.line_pool);
+        unregister_chrdev_region(dev, 1);
+        return -ENOMEM;
+    }
+
     mutex_init(&aesd_device.mutex);
-    aesd_device.command_buffer = NULL;
-    aesd_device.command_buffer_size = 0;
-    aesd_device.bytes_in_command_buffer = 0;
     aesd_circular_buffer_init(&aesd_device.circ_buf);
+    hash_init(aesd_device.dedup_table);
 
     result = aesd_setup_cdev(&aesd_device);
 
     if( result ) {
+        mempool_destroy(aesd_device.chunk_pool);
+        mempool_destroy(aesd_device.line_pool);
         unregister_chrdev_region(dev, 1);
     }
     return result;
@@ -293,19 +1043,21 @@ int aesd_init_module(void)
 void aesd_cleanup_module(void)
 {
     dev_t devno = MKDEV(aesd_major, aesd_minor);
-    int index = 0;
-    struct aesd_buffer_entry *e;
+    uint8_t index;
 
     cdev_del(&aesd_device.cdev);
 
-    PDEBUG("DEBUG BUFFER");
-    AESD_CIRCULAR_BUFFER_FOREACH(e, &aesd_device.circ_buf, index)
+    for(index = 0; index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; index++)
     {
-        if(e->buffptr !=NULL)
-        {
-            kfree(e->buffptr);
-        }
+        aesd_free_entry(index);
+    }
+    aesd_release_pending_chain();
+    if(aesd_device.tail_chunk != NULL)
+    {
+        aesd_chunk_put(aesd_device.tail_chunk);
     }
+    mempool_destroy(aesd_device.chunk_pool);
+    mempool_destroy(aesd_device.line_pool);
 
     unregister_chrdev_region(devno, 1);
 }
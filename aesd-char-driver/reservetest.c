@@ -0,0 +1,217 @@
+/**
+ * @file reservetest.c
+ * @brief Checks the reserve_policy module parameter with the driver built against the shim
+ *
+ * For each policy the driver is loaded with a reserve of a single chunk and
+ * kmalloc() is made to fail.  A short write which fits in the tail chunk must
+ * succeed without touching the reserve, the next line is served from the
+ * reserve and the one after that finds the reserve empty, which is when the
+ * policy applies.  The return value of every write, the lines left in the
+ * ring and the reserve_* counters are checked.  drop_oldest is also checked
+ * with a ring holding only inline lines, whose eviction frees no chunk.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aesdchar.h"
+#include "shim/aesd-shim-api.h"
+
+/* longer than AESDCHAR_INLINE_ENTRY_SIZE, so the lines are stored in chunks */
+#define FIRST_LINE_SIZE 100
+#define LAST_LINE_SIZE 60
+
+struct reserve_counters
+{
+    unsigned long used;
+    unsigned long exhausted;
+    unsigned long dropped_lines;
+};
+
+static unsigned long get_counter(const char *name)
+{
+    char value[32];
+
+    assert(aesd_shim_get_param(name, value, sizeof(value)) == 0);
+    return strtoul(value, NULL, 10);
+}
+
+static struct reserve_counters get_counters(void)
+{
+    struct reserve_counters counters;
+
+    counters.used = get_counter("reserve_used");
+    counters.exhausted = get_counter("reserve_exhausted");
+    counters.dropped_lines = get_counter("reserve_dropped_lines");
+    return counters;
+}
+
+static char *make_line(size_t size, char fill)
+{
+    char *line = malloc(size);
+
+    assert(line != NULL);
+    memset(line, fill, size - 1);
+    line[size - 1] = '\n';
+    return line;
+}
+
+/**
+ * Read the whole ring through @param file and compare it to @param expected
+ */
+static void check_ring(struct aesd_shim_file *file, const char *expected)
+{
+    size_t size = strlen(expected);
+    char *contents = malloc(size + AESD_CHUNK_DATA);
+    long long pos = 0;
+    size_t len = 0;
+    ssize_t rc;
+
+    assert(contents != NULL);
+    while((rc = aesd_shim_read(file, contents + len, size + AESD_CHUNK_DATA - len, &pos)) > 0)
+    {
+        len += (size_t)rc;
+    }
+    assert(rc == 0);
+    assert(len == size && memcmp(contents, expected, size) == 0);
+    free(contents);
+}
+
+static void check_policy(const char *policy)
+{
+    char *first = make_line(FIRST_LINE_SIZE, 'a');
+    char *big = make_line(AESD_CHUNK_DATA, 'b');
+    char *last = make_line(LAST_LINE_SIZE, 'c');
+    char *expected = malloc(FIRST_LINE_SIZE + 4 + AESD_CHUNK_DATA + LAST_LINE_SIZE + 1);
+    struct aesd_shim_file *file;
+    struct reserve_counters counters;
+    ssize_t rc;
+
+    assert(expected != NULL);
+    assert(aesd_shim_set_param("reserve_policy", policy) == 0);
+    assert(aesd_shim_set_param("reserve_chunks", "1") == 0);
+    assert(aesd_shim_set_param("reserve_used", "0") == 0);
+    assert(aesd_shim_set_param("reserve_exhausted", "0") == 0);
+    assert(aesd_shim_set_param("reserve_dropped_lines", "0") == 0);
+    assert(aesd_shim_init() == 0);
+    file = aesd_shim_open();
+    assert(file != NULL);
+
+    assert(aesd_shim_write(file, first, FIRST_LINE_SIZE) == FIRST_LINE_SIZE);
+    aesd_shim_fail_kmalloc(true);
+
+    // fits in the tail chunk, neither the reserve nor the policy are needed
+    assert(aesd_shim_write(file, "end\n", 4) == 4);
+    counters = get_counters();
+    assert(counters.used == 0 && counters.exhausted == 0 && counters.dropped_lines == 0);
+
+    // one chunk and one line from the reserves, which leaves the chunk reserve empty
+    assert(aesd_shim_write(file, big, AESD_CHUNK_DATA) == (ssize_t)AESD_CHUNK_DATA);
+    counters = get_counters();
+    assert(counters.used == 2 && counters.exhausted == 0 && counters.dropped_lines == 0);
+
+    rc = aesd_shim_write(file, last, LAST_LINE_SIZE);
+    counters = get_counters();
+    expected[0] = '\0';
+    if(strcmp(policy, "drop_oldest") == 0)
+    {
+        // the first line is freed, its chunk returns to the reserve and holds the last line
+        assert(rc == LAST_LINE_SIZE);
+        assert(counters.used == 4 && counters.exhausted == 1 && counters.dropped_lines == 1);
+        strcat(expected, "end\n");
+        strncat(expected, big, AESD_CHUNK_DATA);
+        strncat(expected, last, LAST_LINE_SIZE);
+    }
+    else if(strcmp(policy, "drop_newest") == 0)
+    {
+        // the last line is dropped but reported as written
+        assert(rc == LAST_LINE_SIZE);
+        assert(counters.used == 2 && counters.exhausted == 1 && counters.dropped_lines == 1);
+        strncat(expected, first, FIRST_LINE_SIZE);
+        strcat(expected, "end\n");
+        strncat(expected, big, AESD_CHUNK_DATA);
+    }
+    else
+    {
+        assert(rc == -EAGAIN);
+        assert(counters.used == 2 && counters.exhausted == 1 && counters.dropped_lines == 0);
+        strncat(expected, first, FIRST_LINE_SIZE);
+        strcat(expected, "end\n");
+        strncat(expected, big, AESD_CHUNK_DATA);
+    }
+    check_ring(file, expected);
+
+    aesd_shim_fail_kmalloc(false);
+    aesd_shim_release(file);
+    aesd_shim_exit();
+    printf("test successful -> reserve_policy=%s\n", policy);
+    free(first);
+    free(big);
+    free(last);
+    free(expected);
+}
+
+/**
+ * drop_oldest with a ring full of inline lines, which free no chunk when
+ * dropped, must fail the write without emptying the ring
+ */
+static void check_drop_oldest_inline(void)
+{
+    char *open_line = malloc(3 * AESD_CHUNK_DATA);
+    char expected[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED * 4 + 1] = "";
+    struct aesd_shim_file *file;
+    struct reserve_counters counters;
+    size_t written = 0;
+    ssize_t rc;
+    int i;
+
+    assert(open_line != NULL);
+    // no newline, the line stays pending and the ring keeps the inline lines
+    memset(open_line, 'd', 3 * AESD_CHUNK_DATA);
+    assert(aesd_shim_set_param("reserve_policy", "drop_oldest") == 0);
+    assert(aesd_shim_set_param("reserve_chunks", "1") == 0);
+    assert(aesd_shim_set_param("reserve_used", "0") == 0);
+    assert(aesd_shim_set_param("reserve_exhausted", "0") == 0);
+    assert(aesd_shim_set_param("reserve_dropped_lines", "0") == 0);
+    assert(aesd_shim_init() == 0);
+    file = aesd_shim_open();
+    assert(file != NULL);
+
+    for(i = 0; i < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++)
+    {
+        char line[5];
+
+        snprintf(line, sizeof(line), "i%02d\n", i);
+        assert(aesd_shim_write(file, line, 4) == 4);
+        strcat(expected, line);
+    }
+    aesd_shim_fail_kmalloc(true);
+
+    // the reserve chunk takes the first part, the emptied tail chunk goes back to the
+    // reserve and takes the second, after that there is nothing left to drop
+    while((rc = aesd_shim_write(file, open_line + written, 3 * AESD_CHUNK_DATA - written)) > 0)
+    {
+        written += (size_t)rc;
+    }
+    assert(rc == -ENOMEM);
+    assert(written < 3 * AESD_CHUNK_DATA);
+    counters = get_counters();
+    assert(counters.used == 2 && counters.exhausted == 1 && counters.dropped_lines == 0);
+    check_ring(file, expected);
+
+    aesd_shim_fail_kmalloc(false);
+    aesd_shim_release(file);
+    aesd_shim_exit();
+    printf("test successful -> reserve_policy=drop_oldest with inline lines\n");
+    free(open_line);
+}
+
+int main(int argc, char **argv)
+{
+    check_policy("drop_oldest");
+    check_drop_oldest_inline();
+    check_policy("drop_newest");
+    check_policy("eagain");
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * aesd-shim-api.h
+ *
+ * Calls into the driver built against the userspace shim, for programs which
+ * do not include kernel headers.  Mirrors open(), read(), write(), ioctl()
+ * and close() on /dev/aesdchar.
+ */
+
+#ifndef AESD_SHIM_API_H
+#define AESD_SHIM_API_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct aesd_shim_file;
+
+/**
+ * Set the module parameter @param name to @param value, as insmod name=value would.
+ * @return 0 on success, -1 for an unknown parameter or invalid value
+ */
+int aesd_shim_set_param(const char *name, const char *value);
+
+/**
+ * Format the module parameter @param name into @param value as
+ * /sys/module/aesdchar/parameters/<name> would show it.
+ * @return 0 on success, -1 for an unknown parameter
+ */
+int aesd_shim_get_param(const char *name, char *value, size_t size);
+
+/**
+ * Make every kmalloc() in the driver fail while @param fail is set, leaving
+ * only mempool reserves to allocate from
+ */
+void aesd_shim_fail_kmalloc(bool fail);
+
+/**
+ * Run the module init function.  @return 0 on success
+ */
+int aesd_shim_init(void);
+
+/**
+ * Run the module exit function
+ */
+void aesd_shim_exit(void);
+
+/**
+ * @return a new open file on the device or NULL on failure
+ */
+struct aesd_shim_file *aesd_shim_open(void);
+
+void aesd_shim_release(struct aesd_shim_file *file);
+
+/**
+ * Read at @param pos, which is advanced by the number of bytes read like f_pos
+ */
+ssize_t aesd_shim_read(struct aesd_shim_file *file, char *buf, size_t count, long long *pos);
+
+ssize_t aesd_shim_write(struct aesd_shim_file *file, const char *buf, size_t count);
+
+long aesd_shim_ioctl(struct aesd_shim_file *file, unsigned int cmd, unsigned long arg);
+
+#endif /* AESD_SHIM_API_H */
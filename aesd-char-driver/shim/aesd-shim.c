@@ -0,0 +1,197 @@
+/**
+ * @file aesd-shim.c
+ * @brief Glue between aesd-shim-api.h and the driver's file operations
+ *
+ * Built with -Ishim so that main.c and this file see the shim kernel headers.
+ */
+
+#include <linux/fs.h>
+#include <linux/cdev.h>
+#include "../aesdchar.h"
+#include "aesd-shim-api.h"
+
+#define AESD_SHIM_MAX_PARAMS 32
+
+struct aesd_shim_param
+{
+    const char *name;
+    const char *type;
+    void *value;
+};
+
+static struct aesd_shim_param params[AESD_SHIM_MAX_PARAMS];
+static int param_count;
+
+bool aesd_shim_kmalloc_fails;
+
+struct aesd_shim_file
+{
+    struct inode inode;
+    struct file file;
+};
+
+extern struct aesd_dev aesd_device;
+extern struct file_operations aesd_fops;
+extern int aesd_init_module(void);
+extern void aesd_cleanup_module(void);
+
+void aesd_shim_register_param(const char *name, const char *type, void *value)
+{
+    if(param_count < AESD_SHIM_MAX_PARAMS)
+    {
+        params[param_count].name = name;
+        params[param_count].type = type;
+        params[param_count].value = value;
+        param_count++;
+    }
+}
+
+int aesd_shim_set_param(const char *name, const char *value)
+{
+    int i;
+
+    for(i = 0; i < param_count; i++)
+    {
+        const struct aesd_shim_param *param = &params[i];
+        char *end = NULL;
+
+        if(strcmp(param->name, name) != 0)
+        {
+            continue;
+        }
+        if(strcmp(param->type, "bool") == 0)
+        {
+            *(bool *)param->value = (strcmp(value, "1") == 0 || strcmp(value, "y") == 0
+                    || strcmp(value, "Y") == 0);
+            return 0;
+        }
+        if(strcmp(param->type, "int") == 0)
+        {
+            *(int *)param->value = (int)strtol(value, &end, 0);
+        }
+        else if(strcmp(param->type, "uint") == 0)
+        {
+            *(unsigned int *)param->value = (unsigned int)strtoul(value, &end, 0);
+        }
+        else if(strcmp(param->type, "ulong") == 0)
+        {
+            *(unsigned long *)param->value = strtoul(value, &end, 0);
+        }
+        else if(strcmp(param->type, "charp") == 0)
+        {
+            *(const char **)param->value = value;
+            return 0;
+        }
+        else
+        {
+            return -1;
+        }
+        return (end != NULL && *end == '\0') ? 0 : -1;
+    }
+    return -1;
+}
+
+int aesd_shim_get_param(const char *name, char *value, size_t size)
+{
+    int i;
+
+    for(i = 0; i < param_count; i++)
+    {
+        const struct aesd_shim_param *param = &params[i];
+
+        if(strcmp(param->name, name) != 0)
+        {
+            continue;
+        }
+        if(strcmp(param->type, "bool") == 0)
+        {
+            snprintf(value, size, "%c", *(bool *)param->value ? 'Y' : 'N');
+        }
+        else if(strcmp(param->type, "int") == 0)
+        {
+            snprintf(value, size, "%d", *(int *)param->value);
+        }
+        else if(strcmp(param->type, "uint") == 0)
+        {
+            snprintf(value, size, "%u", *(unsigned int *)param->value);
+        }
+        else if(strcmp(param->type, "ulong") == 0)
+        {
+            snprintf(value, size, "%lu", *(unsigned long *)param->value);
+        }
+        else if(strcmp(param->type, "charp") == 0)
+        {
+            snprintf(value, size, "%s", *(const char **)param->value);
+        }
+        else
+        {
+            return -1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+void aesd_shim_fail_kmalloc(bool fail)
+{
+    __atomic_store_n(&aesd_shim_kmalloc_fails, fail, __ATOMIC_RELAXED);
+}
+
+int aesd_shim_init(void)
+{
+    return aesd_init_module();
+}
+
+void aesd_shim_exit(void)
+{
+    aesd_cleanup_module();
+}
+
+struct aesd_shim_file *aesd_shim_open(void)
+{
+    struct aesd_shim_file *file = calloc(1, sizeof(*file));
+
+    if(file == NULL)
+    {
+        return NULL;
+    }
+    file->inode.i_cdev = &aesd_device.cdev;
+    if(aesd_fops.open != NULL && aesd_fops.open(&file->inode, &file->file) != 0)
+    {
+        free(file);
+        return NULL;
+    }
+    return file;
+}
+
+void aesd_shim_release(struct aesd_shim_file *file)
+{
+    if(aesd_fops.release != NULL)
+    {
+        aesd_fops.release(&file->inode, &file->file);
+    }
+    free(file);
+}
+
+ssize_t aesd_shim_read(struct aesd_shim_file *file, char *buf, size_t count, long long *pos)
+{
+    loff_t f_pos = *pos;
+    ssize_t rc = aesd_fops.read(&file->file, buf, count, &f_pos);
+
+    *pos = f_pos;
+    return rc;
+}
+
+ssize_t aesd_shim_write(struct aesd_shim_file *file, const char *buf, size_t count)
+{
+    return aesd_fops.write(&file->file, buf, count, &file->file.f_pos);
+}
+
+long aesd_shim_ioctl(struct aesd_shim_file *file, unsigned int cmd, unsigned long arg)
+{
+    if(aesd_fops.unlocked_ioctl == NULL)
+    {
+        return -ENOTTY;
+    }
+    return aesd_fops.unlocked_ioctl(&file->file, cmd, arg);
+}
@@ -0,0 +1,381 @@
+/*
+ * aesd-shim.h
+ *
+ * Minimal userspace stand-ins for the kernel interfaces used by main.c, so
+ * the driver can be built into a normal process and benchmarked without a
+ * kernel.  Only what the driver uses is provided, with the same semantics
+ * as far as a single process can tell.  Each shim/linux/<name>.h simply
+ * includes this file.
+ */
+
+#ifndef AESD_SHIM_H
+#define AESD_SHIM_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define __user
+
+#ifndef ERESTARTSYS
+#define ERESTARTSYS 512
+#endif
+
+typedef uint8_t u8;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* printk */
+#define KERN_ERR     ""
+#define KERN_WARNING ""
+#define KERN_INFO    ""
+#define KERN_DEBUG   ""
+#define printk(fmt, ...) fprintf(stderr, fmt, ##__VA_ARGS__)
+
+/* module */
+struct module;
+#define THIS_MODULE ((struct module *)NULL)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define module_init(fn)
+#define module_exit(fn)
+
+/*
+ * Module parameters register themselves at startup so programs using the
+ * shim can set them with aesd_shim_set_param() before aesd_shim_init()
+ */
+void aesd_shim_register_param(const char *name, const char *type, void *value);
+#define S_IRUGO 0444
+#define module_param(name, type, perm) \
+    static void __attribute__((constructor)) aesd_shim_register_param_##name(void) \
+    { \
+        aesd_shim_register_param(#name, #type, &name); \
+    }
+#define MODULE_PARM_DESC(name, desc)
+
+/* mm, slab */
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 4096ul
+#endif
+
+typedef unsigned int gfp_t;
+#define __GFP_DIRECT_RECLAIM 0x400u
+#define GFP_KERNEL    __GFP_DIRECT_RECLAIM
+#define GFP_NOWAIT    0u
+#define __GFP_NORETRY 0u
+#define __GFP_NOWARN  0u
+
+static inline bool gfpflags_allow_blocking(gfp_t flags)
+{
+    return (flags & __GFP_DIRECT_RECLAIM) != 0;
+}
+
+/* set through aesd_shim_fail_kmalloc() to simulate memory pressure */
+extern bool aesd_shim_kmalloc_fails;
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+    (void)flags;
+    if(__atomic_load_n(&aesd_shim_kmalloc_fails, __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+    return malloc(size);
+}
+
+static inline void *krealloc(const void *p, size_t size, gfp_t flags)
+{
+    (void)flags;
+    return realloc((void *)p, size);
+}
+
+static inline void kfree(const void *p)
+{
+    free((void *)p);
+}
+
+/*
+ * mempool, like the kernel's mempool_alloc() tries the pool's allocator
+ * without sleeping first and falls back to the reserved elements
+ */
+typedef void *(mempool_alloc_t)(gfp_t flags, void *pool_data);
+typedef void (mempool_free_t)(void *element, void *pool_data);
+
+typedef struct mempool_s
+{
+    pthread_mutex_t lock;
+    int min_nr;
+    int curr_nr;
+    void **elements;
+    mempool_alloc_t *alloc;
+    mempool_free_t *free;
+    void *pool_data;
+} mempool_t;
+
+static inline void mempool_kfree(void *element, void *pool_data)
+{
+    (void)pool_data;
+    kfree(element);
+}
+
+static inline void mempool_destroy(mempool_t *pool)
+{
+    if(pool == NULL)
+    {
+        return;
+    }
+    while(pool->curr_nr > 0)
+    {
+        pool->free(pool->elements[--pool->curr_nr], pool->pool_data);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->elements);
+    free(pool);
+}
+
+static inline mempool_t *mempool_create(int min_nr, mempool_alloc_t *alloc_fn, mempool_free_t *free_fn,
+        void *pool_data)
+{
+    mempool_t *pool = calloc(1, sizeof(*pool));
+
+    if(pool == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->min_nr = min_nr;
+    pool->alloc = alloc_fn;
+    pool->free = free_fn;
+    pool->pool_data = pool_data;
+    pool->elements = calloc(min_nr > 0 ? min_nr : 1, sizeof(*pool->elements));
+    if(pool->elements == NULL)
+    {
+        mempool_destroy(pool);
+        return NULL;
+    }
+    while(pool->curr_nr < min_nr)
+    {
+        void *element = alloc_fn(GFP_KERNEL, pool_data);
+        if(element == NULL)
+        {
+            mempool_destroy(pool);
+            return NULL;
+        }
+        pool->elements[pool->curr_nr++] = element;
+    }
+    return pool;
+}
+
+static inline void *mempool_alloc(mempool_t *pool, gfp_t flags)
+{
+    void *element = pool->alloc(flags & ~__GFP_DIRECT_RECLAIM, pool->pool_data);
+
+    if(element == NULL)
+    {
+        pthread_mutex_lock(&pool->lock);
+        if(pool->curr_nr > 0)
+        {
+            element = pool->elements[--pool->curr_nr];
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return element;
+}
+
+static inline void mempool_free(void *element, mempool_t *pool)
+{
+    if(element == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    if(pool->curr_nr < pool->min_nr)
+    {
+        pool->elements[pool->curr_nr++] = element;
+        element = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if(element != NULL)
+    {
+        pool->free(element, pool->pool_data);
+    }
+}
+
+/* hashtable */
+struct hlist_node
+{
+    struct hlist_node *next;
+    struct hlist_node **pprev;
+};
+
+struct hlist_head
+{
+    struct hlist_node *first;
+};
+
+#define DECLARE_HASHTABLE(name, bits) struct hlist_head name[1 << (bits)]
+#define hash_init(table) memset((table), 0, sizeof(table))
+#define hash_add(table, node, key) hlist_add_head((node), &(table)[(key) % ARRAY_SIZE(table)])
+#define hash_for_each_possible(table, obj, member, key) \
+    for((obj) = (table)[(key) % ARRAY_SIZE(table)].first ? \
+                container_of((table)[(key) % ARRAY_SIZE(table)].first, typeof(*(obj)), member) : NULL; \
+            (obj) != NULL; \
+            (obj) = (obj)->member.next ? container_of((obj)->member.next, typeof(*(obj)), member) : NULL)
+
+static inline void hlist_add_head(struct hlist_node *node, struct hlist_head *head)
+{
+    node->next = head->first;
+    if(head->first != NULL)
+    {
+        head->first->pprev = &node->next;
+    }
+    head->first = node;
+    node->pprev = &head->first;
+}
+
+static inline void hash_del(struct hlist_node *node)
+{
+    *node->pprev = node->next;
+    if(node->next != NULL)
+    {
+        node->next->pprev = node->pprev;
+    }
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+/* jhash, any reasonable hash will do for the shim */
+static inline u32 jhash(const void *key, u32 length, u32 initval)
+{
+    const unsigned char *data = (const unsigned char *)key;
+    u32 hash = 2166136261u ^ initval;
+    u32 i;
+
+    for(i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* uaccess, user and kernel memory are the same here */
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+/* mutex */
+struct mutex
+{
+    pthread_mutex_t lock;
+};
+
+static inline void mutex_init(struct mutex *m)
+{
+    pthread_mutex_init(&m->lock, NULL);
+}
+
+static inline void mutex_lock(struct mutex *m)
+{
+    pthread_mutex_lock(&m->lock);
+}
+
+static inline int mutex_lock_interruptible(struct mutex *m)
+{
+    return pthread_mutex_lock(&m->lock) == 0 ? 0 : -EINTR;
+}
+
+static inline void mutex_unlock(struct mutex *m)
+{
+    pthread_mutex_unlock(&m->lock);
+}
+
+/* fs and cdev */
+#define MINORBITS 20
+#define MINORMASK ((1U << MINORBITS) - 1)
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev) & MINORMASK))
+#define MKDEV(ma, mi) (((ma) << MINORBITS) | (mi))
+
+struct inode;
+struct file;
+
+struct file_operations
+{
+    struct module *owner;
+    loff_t (*llseek)(struct file *, loff_t, int);
+    ssize_t (*read)(struct file *, char __user *, size_t, loff_t *);
+    ssize_t (*write)(struct file *, const char __user *, size_t, loff_t *);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+};
+
+struct cdev
+{
+    struct module *owner;
+    const struct file_operations *ops;
+};
+
+struct inode
+{
+    struct cdev *i_cdev;
+};
+
+struct file
+{
+    loff_t f_pos;
+    unsigned int f_flags;
+    void *private_data;
+};
+
+static inline void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+    cdev->ops = fops;
+}
+
+static inline int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+    (void)cdev;
+    (void)dev;
+    (void)count;
+    return 0;
+}
+
+static inline void cdev_del(struct cdev *cdev)
+{
+    (void)cdev;
+}
+
+static inline int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count, const char *name)
+{
+    (void)count;
+    (void)name;
+    *dev = MKDEV(240u, baseminor);
+    return 0;
+}
+
+static inline void unregister_chrdev_region(dev_t dev, unsigned int count)
+{
+    (void)dev;
+    (void)count;
+}
+
+#endif /* AESD_SHIM_H */
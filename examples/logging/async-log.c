@@ -0,0 +1,606 @@
+/*
+ * async-log.c
+ *
+ * See async-log.h.  Every logging thread owns a single producer, single
+ * consumer byte ring.  Records are appended at head by the owner and
+ * consumed at tail by the background thread, both counters only ever grow
+ * and are masked to find the position in the ring.  A record that does not
+ * fit before the end of the ring is preceded by a padding record filling
+ * the rest, so every record is contiguous.
+ */
+
+#include "async-log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DEFAULT_RING_SIZE (64 * 1024)
+/* large enough for a record with every argument a string of maximum length */
+#define MIN_RING_SIZE (16 * 1024)
+#define DEFAULT_DRAIN_INTERVAL_MS 5
+/* longest formatted message, longer ones are truncated */
+#define MAX_MESSAGE 1024
+
+#define LEVEL_PADDING (-1)
+
+struct log_record
+{
+    /* bytes including arguments and strings, a multiple of 8 */
+    uint32_t size;
+    /* syslog level or LEVEL_PADDING */
+    int32_t level;
+    const char *fmt;
+    uint64_t timestamp_ns;
+    /*
+     * ends with an ASYNC_LOG_ARG_END entry.  The value of a string argument
+     * is the offset of the copied string from the start of the record,
+     * 0 for NULL.
+     */
+    struct async_log_arg args[];
+};
+
+struct log_ring
+{
+    /* next byte to write, only changed by the owner */
+    _Atomic uint64_t head __attribute__((aligned(64)));
+    /* next byte to read, only changed by the background thread */
+    _Atomic uint64_t tail __attribute__((aligned(64)));
+    _Atomic uint64_t dropped;
+    /* set while a thread owns the ring, released when the thread exits */
+    atomic_bool in_use;
+    /* next ring in the registry, never changes once published */
+    struct log_ring *next;
+    size_t size;
+    char *data;
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t flushed;
+    pthread_t thread;
+    atomic_bool running;
+    /* set by a thread whose ring is half full until the background thread runs */
+    atomic_bool wake_pending;
+    bool stopping;
+    bool atexit_registered;
+    unsigned long long flush_requested;
+    unsigned long long flush_done;
+    struct async_log_config config;
+    /* every ring ever allocated, pushed at the front */
+    struct log_ring *_Atomic rings;
+    /* drops already reported by the background thread */
+    unsigned long long dropped_reported;
+} logger = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .flushed = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static __thread struct log_ring *thread_ring;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static size_t align8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+static void release_ring(void *ring)
+{
+    atomic_store_explicit(&((struct log_ring *)ring)->in_use, false, memory_order_release);
+}
+
+static void create_key(void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+/**
+ * @return a ring for the calling thread, reusing one released by an exited
+ * thread if possible, or NULL if none could be allocated
+ */
+static struct log_ring *claim_ring(void)
+{
+    struct log_ring *ring;
+    size_t size;
+
+    pthread_once(&key_once, create_key);
+    for(ring = atomic_load_explicit(&logger.rings, memory_order_acquire); ring != NULL; ring = ring->next)
+    {
+        bool expected = false;
+        if(atomic_compare_exchange_strong(&ring->in_use, &expected, true))
+        {
+            break;
+        }
+    }
+
+    if(ring == NULL)
+    {
+        size = logger.config.ring_size != 0 ? logger.config.ring_size : DEFAULT_RING_SIZE;
+        ring = calloc(1, sizeof(*ring));
+        if(ring == NULL)
+        {
+            return NULL;
+        }
+        ring->size = size;
+        ring->data = malloc(size);
+        if(ring->data == NULL)
+        {
+            free(ring);
+            return NULL;
+        }
+        atomic_init(&ring->in_use, true);
+        ring->next = atomic_load_explicit(&logger.rings, memory_order_relaxed);
+        while(!atomic_compare_exchange_weak_explicit(&logger.rings, &ring->next, ring,
+                    memory_order_release, memory_order_relaxed))
+        {
+        }
+    }
+
+    pthread_setspecific(ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+void async_log_write(int level, const char *fmt, const struct async_log_arg *args)
+{
+    struct log_ring *ring = thread_ring;
+    struct log_record *record;
+    size_t lengths[ASYNC_LOG_MAX_ARGS];
+    size_t nargs = 0;
+    size_t size;
+    size_t offset;
+    size_t contiguous;
+    uint64_t head;
+    uint64_t tail;
+    size_t i;
+
+    if(!atomic_load_explicit(&logger.running, memory_order_acquire))
+    {
+        async_log_init(NULL);
+    }
+    if(ring == NULL)
+    {
+        ring = claim_ring();
+        if(ring == NULL)
+        {
+            return;
+        }
+    }
+
+    size = sizeof(struct log_record);
+    while(args[nargs].type != ASYNC_LOG_ARG_END && nargs < ASYNC_LOG_MAX_ARGS)
+    {
+        if(args[nargs].type == ASYNC_LOG_ARG_STRING && args[nargs].value.s != NULL)
+        {
+            lengths[nargs] = strnlen(args[nargs].value.s, ASYNC_LOG_MAX_STRING);
+            size += lengths[nargs] + 1;
+        }
+        nargs++;
+    }
+    offset = sizeof(struct log_record) + (nargs + 1) * sizeof(struct async_log_arg);
+    size = align8(size + (nargs + 1) * sizeof(struct async_log_arg));
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    contiguous = ring->size - (head & (ring->size - 1));
+    if(contiguous < size)
+    {
+        if(ring->size - (head - tail) < contiguous + size)
+        {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        record = (struct log_record *)(ring->data + (head & (ring->size - 1)));
+        record->size = (uint32_t)contiguous;
+        record->level = LEVEL_PADDING;
+        head += contiguous;
+    }
+    else if(ring->size - (head - tail) < size)
+    {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    record = (struct log_record *)(ring->data + (head & (ring->size - 1)));
+    record->size = (uint32_t)size;
+    record->level = level;
+    record->fmt = fmt;
+    record->timestamp_ns = now_ns();
+    for(i = 0; i < nargs; i++)
+    {
+        record->args[i] = args[i];
+        if(args[i].type == ASYNC_LOG_ARG_STRING)
+        {
+            record->args[i].value.u = 0;
+            if(args[i].value.s != NULL)
+            {
+                memcpy((char *)record + offset, args[i].value.s, lengths[i]);
+                ((char *)record)[offset + lengths[i]] = '\0';
+                record->args[i].value.u = offset;
+                offset += lengths[i] + 1;
+            }
+        }
+    }
+    record->args[nargs].type = ASYNC_LOG_ARG_END;
+    atomic_store_explicit(&ring->head, head + size, memory_order_release);
+
+    /*
+     * Wake the background thread early rather than drop messages.  Signaling
+     * without the mutex may miss a thread about to wait, it then runs after
+     * the drain interval as usual.
+     */
+    if(head + size - tail > ring->size / 2
+            && !atomic_exchange_explicit(&logger.wake_pending, true, memory_order_relaxed))
+    {
+        pthread_cond_signal(&logger.wake);
+    }
+}
+
+static long long arg_as_int(const struct async_log_arg *arg)
+{
+    switch(arg->type)
+    {
+        case ASYNC_LOG_ARG_UINT:
+            return (long long)arg->value.u;
+        case ASYNC_LOG_ARG_DOUBLE:
+            return (long long)arg->value.d;
+        default:
+            return arg->value.i;
+    }
+}
+
+static double arg_as_double(const struct async_log_arg *arg)
+{
+    switch(arg->type)
+    {
+        case ASYNC_LOG_ARG_INT:
+            return (double)arg->value.i;
+        case ASYNC_LOG_ARG_UINT:
+            return (double)arg->value.u;
+        case ASYNC_LOG_ARG_DOUBLE:
+            return arg->value.d;
+        default:
+            return 0.0;
+    }
+}
+
+/**
+ * Format @param record into @param out like printf() would have
+ * @return the length of the message in @param out
+ */
+static size_t format_record(const struct log_record *record, char *out, size_t out_size)
+{
+    const struct async_log_arg *arg = record->args;
+    const char *p = record->fmt;
+    size_t len = 0;
+
+    while(*p != '\0' && len + 1 < out_size)
+    {
+        const char *start = p;
+        char spec[32];
+        size_t spec_len = 1;
+        int n = 0;
+        char conv;
+
+        if(*p != '%')
+        {
+            out[len++] = *p++;
+            continue;
+        }
+        if(p[1] == '%')
+        {
+            out[len++] = '%';
+            p += 2;
+            continue;
+        }
+
+        /* keep flags, width and precision, the length modifier is chosen below */
+        spec[0] = '%';
+        p++;
+        while(*p != '\0' && strchr("-+ #0123456789.", *p) != NULL && spec_len < sizeof(spec) - 4)
+        {
+            spec[spec_len++] = *p++;
+        }
+        while(*p != '\0' && strchr("hlLqjzt", *p) != NULL)
+        {
+            p++;
+        }
+        conv = *p;
+        if(conv == '\0')
+        {
+            break;
+        }
+        p++;
+
+        if(arg->type == ASYNC_LOG_ARG_END || strchr("diouxXcsp" "eEfFgGaA", conv) == NULL)
+        {
+            /* missing argument or unsupported conversion, print it as written */
+            n = snprintf(out + len, out_size - len, "%.*s", (int)(p - start), start);
+        }
+        else
+        {
+            switch(conv)
+            {
+                case 'd':
+                case 'i':
+                    memcpy(spec + spec_len, "lld", 4);
+                    n = snprintf(out + len, out_size - len, spec, arg_as_int(arg));
+                    break;
+                case 'o':
+                case 'u':
+                case 'x':
+                case 'X':
+                    spec[spec_len++] = 'l';
+                    spec[spec_len++] = 'l';
+                    spec[spec_len++] = conv;
+                    spec[spec_len] = '\0';
+                    n = snprintf(out + len, out_size - len, spec, (unsigned long long)arg_as_int(arg));
+                    break;
+                case 'c':
+                    memcpy(spec + spec_len, "c", 2);
+                    n = snprintf(out + len, out_size - len, spec, (int)arg_as_int(arg));
+                    break;
+                case 's':
+                    memcpy(spec + spec_len, "s", 2);
+                    n = snprintf(out + len, out_size - len, spec,
+                            arg->type == ASYNC_LOG_ARG_STRING && arg->value.u != 0
+                            ? (const char *)record + arg->value.u : "(null)");
+                    break;
+                case 'p':
+                    memcpy(spec + spec_len, "p", 2);
+                    n = snprintf(out + len, out_size - len, spec, arg->value.p);
+                    break;
+                default:
+                    spec[spec_len++] = conv;
+                    spec[spec_len] = '\0';
+                    n = snprintf(out + len, out_size - len, spec, arg_as_double(arg));
+                    break;
+            }
+            arg++;
+        }
+
+        if(n > 0)
+        {
+            len += (size_t)n < out_size - len ? (size_t)n : out_size - len - 1;
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static void emit(int level, const char *message, size_t len)
+{
+    if(logger.config.sink == ASYNC_LOG_SINK_SYSLOG)
+    {
+        syslog(level, "%s", message);
+    }
+    else
+    {
+        fwrite(message, 1, len, logger.config.stream);
+    }
+}
+
+/**
+ * @return the next message record of @param ring, skipping padding, or NULL if there is none
+ */
+static struct log_record *next_record(struct log_ring *ring)
+{
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    struct log_record *record;
+
+    while(tail != head)
+    {
+        record = (struct log_record *)(ring->data + (tail & (ring->size - 1)));
+        if(record->level != LEVEL_PADDING)
+        {
+            return record;
+        }
+        tail += record->size;
+        atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    }
+    return NULL;
+}
+
+/**
+ * Write out everything in the rings, merging them by timestamp
+ */
+static void drain(void)
+{
+    char message[MAX_MESSAGE];
+    unsigned long long dropped = 0;
+    struct log_ring *ring;
+    size_t len;
+
+    for(;;)
+    {
+        struct log_ring *oldest_ring = NULL;
+        struct log_record *oldest = NULL;
+
+        for(ring = atomic_load_explicit(&logger.rings, memory_order_acquire); ring != NULL; ring = ring->next)
+        {
+            struct log_record *record = next_record(ring);
+            if(record != NULL && (oldest == NULL || record->timestamp_ns < oldest->timestamp_ns))
+            {
+                oldest = record;
+                oldest_ring = ring;
+            }
+        }
+        if(oldest == NULL)
+        {
+            break;
+        }
+        len = format_record(oldest, message, sizeof(message));
+        emit(oldest->level, message, len);
+        atomic_store_explicit(&oldest_ring->tail,
+                atomic_load_explicit(&oldest_ring->tail, memory_order_relaxed) + oldest->size,
+                memory_order_release);
+    }
+
+    for(ring = atomic_load_explicit(&logger.rings, memory_order_acquire); ring != NULL; ring = ring->next)
+    {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    if(dropped > logger.dropped_reported)
+    {
+        len = (size_t)snprintf(message, sizeof(message), "async-log: %llu messages dropped\n",
+                dropped - logger.dropped_reported);
+        emit(LOG_WARNING, message, len < sizeof(message) ? len : sizeof(message) - 1);
+        logger.dropped_reported = dropped;
+    }
+
+    if(logger.config.sink == ASYNC_LOG_SINK_STREAM)
+    {
+        fflush(logger.config.stream);
+    }
+}
+
+static void *drain_thread(void *arg)
+{
+    unsigned long long request;
+    struct timespec deadline;
+    bool stop;
+
+    (void)arg;
+    pthread_mutex_lock(&logger.lock);
+    for(;;)
+    {
+        request = logger.flush_requested;
+        stop = logger.stopping;
+        pthread_mutex_unlock(&logger.lock);
+
+        atomic_store_explicit(&logger.wake_pending, false, memory_order_relaxed);
+        drain();
+
+        pthread_mutex_lock(&logger.lock);
+        logger.flush_done = request;
+        pthread_cond_broadcast(&logger.flushed);
+        if(stop)
+        {
+            break;
+        }
+        if(logger.flush_requested == request && !logger.stopping)
+        {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (long)logger.config.drain_interval_ms * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&logger.wake, &logger.lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&logger.lock);
+    return NULL;
+}
+
+int async_log_init(const struct async_log_config *config)
+{
+    size_t ring_size;
+    int rc;
+
+    pthread_mutex_lock(&logger.lock);
+    if(atomic_load_explicit(&logger.running, memory_order_relaxed))
+    {
+        pthread_mutex_unlock(&logger.lock);
+        return EBUSY;
+    }
+
+    memset(&logger.config, 0, sizeof(logger.config));
+    if(config != NULL)
+    {
+        logger.config = *config;
+    }
+    if(logger.config.stream == NULL)
+    {
+        logger.config.stream = stdout;
+    }
+    if(logger.config.drain_interval_ms == 0)
+    {
+        logger.config.drain_interval_ms = DEFAULT_DRAIN_INTERVAL_MS;
+    }
+    if(logger.config.ring_size == 0)
+    {
+        logger.config.ring_size = DEFAULT_RING_SIZE;
+    }
+    for(ring_size = MIN_RING_SIZE; ring_size < logger.config.ring_size; ring_size *= 2)
+    {
+    }
+    logger.config.ring_size = ring_size;
+
+    logger.stopping = false;
+    rc = pthread_create(&logger.thread, NULL, drain_thread, NULL);
+    if(rc == 0)
+    {
+        atomic_store_explicit(&logger.running, true, memory_order_release);
+        if(!logger.atexit_registered)
+        {
+            logger.atexit_registered = atexit(async_log_shutdown) == 0;
+        }
+    }
+    pthread_mutex_unlock(&logger.lock);
+    return rc;
+}
+
+void async_log_flush(void)
+{
+    unsigned long long request;
+
+    pthread_mutex_lock(&logger.lock);
+    if(atomic_load_explicit(&logger.running, memory_order_relaxed))
+    {
+        request = ++logger.flush_requested;
+        pthread_cond_signal(&logger.wake);
+        while(logger.flush_done < request && atomic_load_explicit(&logger.running, memory_order_relaxed))
+        {
+            pthread_cond_wait(&logger.flushed, &logger.lock);
+        }
+    }
+    pthread_mutex_unlock(&logger.lock);
+}
+
+void async_log_shutdown(void)
+{
+    pthread_mutex_lock(&logger.lock);
+    if(!atomic_load_explicit(&logger.running, memory_order_relaxed) || logger.stopping)
+    {
+        pthread_mutex_unlock(&logger.lock);
+        return;
+    }
+    logger.stopping = true;
+    pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.lock);
+
+    /* the background thread drains once more after seeing stopping */
+    pthread_join(logger.thread, NULL);
+
+    pthread_mutex_lock(&logger.lock);
+    atomic_store_explicit(&logger.running, false, memory_order_release);
+    logger.stopping = false;
+    pthread_cond_broadcast(&logger.flushed);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+unsigned long long async_log_dropped(void)
+{
+    unsigned long long dropped = 0;
+    struct log_ring *ring;
+
+    for(ring = atomic_load_explicit(&logger.rings, memory_order_acquire); ring != NULL; ring = ring->next)
+    {
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
@@ -0,0 +1,219 @@
+/*
+ * async-log.h
+ *
+ * Asynchronous logging for code where a printf() or syslog() call per
+ * message would serialize threads on the stdio or socket lock.  ASYNC_LOG()
+ * copies the format string pointer and the raw arguments into a lock free
+ * ring owned by the calling thread; a background thread drains all rings,
+ * formats the messages in timestamp order and writes them to a stream or
+ * to syslog.  Levels above ASYNC_LOG_LEVEL are compiled out.
+ *
+ * Formatting is deferred, so the format must be a string literal or
+ * otherwise outlive the process, string arguments are copied (truncated to
+ * ASYNC_LOG_MAX_STRING bytes) and at most ASYNC_LOG_MAX_ARGS arguments are
+ * supported.  '*' widths and precisions are not.  When a ring is full
+ * messages are dropped and counted rather than blocking the caller.
+ */
+
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <syslog.h>
+
+/**
+ * Most verbose syslog level compiled in, messages with a numerically larger
+ * level cost nothing.  Define before including this file, or with -D.
+ */
+#ifndef ASYNC_LOG_LEVEL
+#define ASYNC_LOG_LEVEL LOG_DEBUG
+#endif
+
+#define ASYNC_LOG_MAX_ARGS 8
+#define ASYNC_LOG_MAX_STRING 256
+
+enum async_log_sink
+{
+    /* write to async_log_config.stream, stdout by default */
+    ASYNC_LOG_SINK_STREAM,
+    /* syslog() with the message level, the caller opens the log */
+    ASYNC_LOG_SINK_SYSLOG,
+};
+
+struct async_log_config
+{
+    enum async_log_sink sink;
+    FILE *stream;
+    /**
+     * Bytes of the ring each logging thread gets, rounded up to a power of two
+     */
+    size_t ring_size;
+    /**
+     * How often the background thread looks for new messages
+     */
+    unsigned int drain_interval_ms;
+};
+
+enum async_log_arg_type
+{
+    ASYNC_LOG_ARG_END,
+    ASYNC_LOG_ARG_INT,
+    ASYNC_LOG_ARG_UINT,
+    ASYNC_LOG_ARG_DOUBLE,
+    ASYNC_LOG_ARG_STRING,
+    ASYNC_LOG_ARG_POINTER,
+};
+
+/**
+ * One captured argument, built by ASYNC_LOG()
+ */
+struct async_log_arg
+{
+    enum async_log_arg_type type;
+    union
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        const char *s;
+        const void *p;
+    } value;
+};
+
+/**
+ * Start logging with @param config, NULL for the defaults: stdout, 64 KiB
+ * per thread, drained every 5 ms.  Optional, the first message starts
+ * logging with the defaults.  Registers async_log_shutdown() with atexit().
+ * @return 0 on success or an errno value, EBUSY if logging already started
+ */
+int async_log_init(const struct async_log_config *config);
+
+/**
+ * Block until every message logged before the call has been written
+ */
+void async_log_flush(void);
+
+/**
+ * Flush and stop the background thread.  The rings are kept for the threads
+ * that own them, a message logged afterwards starts logging again with the
+ * defaults.
+ */
+void async_log_shutdown(void);
+
+/**
+ * @return the number of messages dropped so far because a ring was full
+ */
+unsigned long long async_log_dropped(void);
+
+/**
+ * Queue a message, called by ASYNC_LOG().  @param args ends with an ASYNC_LOG_ARG_END entry.
+ */
+void async_log_write(int level, const char *fmt, const struct async_log_arg *args);
+
+static inline struct async_log_arg async_log_arg_int(long long v)
+{
+    struct async_log_arg arg = { ASYNC_LOG_ARG_INT, { .i = v } };
+    return arg;
+}
+
+static inline struct async_log_arg async_log_arg_uint(unsigned long long v)
+{
+    struct async_log_arg arg = { ASYNC_LOG_ARG_UINT, { .u = v } };
+    return arg;
+}
+
+static inline struct async_log_arg async_log_arg_double(double v)
+{
+    struct async_log_arg arg = { ASYNC_LOG_ARG_DOUBLE, { .d = v } };
+    return arg;
+}
+
+static inline struct async_log_arg async_log_arg_string(const char *v)
+{
+    struct async_log_arg arg = { ASYNC_LOG_ARG_STRING, { .s = v } };
+    return arg;
+}
+
+/* byte buffers passed for %s are copied as strings too */
+static inline struct async_log_arg async_log_arg_signed_string(const signed char *v)
+{
+    return async_log_arg_string((const char *)v);
+}
+
+static inline struct async_log_arg async_log_arg_unsigned_string(const unsigned char *v)
+{
+    return async_log_arg_string((const char *)v);
+}
+
+static inline struct async_log_arg async_log_arg_pointer(const void *v)
+{
+    struct async_log_arg arg = { ASYNC_LOG_ARG_POINTER, { .p = v } };
+    return arg;
+}
+
+#define ASYNC_LOG_ARG(x) _Generic((x), \
+        _Bool: async_log_arg_int, \
+        char: async_log_arg_int, \
+        signed char: async_log_arg_int, \
+        short: async_log_arg_int, \
+        int: async_log_arg_int, \
+        long: async_log_arg_int, \
+        long long: async_log_arg_int, \
+        unsigned char: async_log_arg_uint, \
+        unsigned short: async_log_arg_uint, \
+        unsigned int: async_log_arg_uint, \
+        unsigned long: async_log_arg_uint, \
+        unsigned long long: async_log_arg_uint, \
+        float: async_log_arg_double, \
+        double: async_log_arg_double, \
+        char *: async_log_arg_string, \
+        const char *: async_log_arg_string, \
+        signed char *: async_log_arg_signed_string, \
+        const signed char *: async_log_arg_signed_string, \
+        unsigned char *: async_log_arg_unsigned_string, \
+        const unsigned char *: async_log_arg_unsigned_string, \
+        default: async_log_arg_pointer)(x)
+
+#define ASYNC_LOG_CAT_(a, b) a##b
+#define ASYNC_LOG_CAT(a, b) ASYNC_LOG_CAT_(a, b)
+/* more than ASYNC_LOG_MAX_ARGS arguments expand to the undefined ASYNC_LOG_MAP_too_many_arguments() */
+#define ASYNC_LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, n, ...) n
+#define ASYNC_LOG_NARGS(...) ASYNC_LOG_NARGS_(_, ##__VA_ARGS__, too_many_arguments, too_many_arguments, \
+        too_many_arguments, too_many_arguments, too_many_arguments, too_many_arguments, too_many_arguments, \
+        too_many_arguments, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define ASYNC_LOG_MAP_0()
+#define ASYNC_LOG_MAP_1(a) ASYNC_LOG_ARG(a),
+#define ASYNC_LOG_MAP_2(a, ...) ASYNC_LOG_ARG(a), ASYNC_LOG_MAP_1(__VA_ARGS__)
+#define ASYNC_LOG_MAP_3(a, ...) ASYNC_LOG_ARG(a), ASYNC_LOG_MAP_2(__VA_ARGS__)
+#define ASYNC_LOG_MAP_4(a, ...) ASYNC_LOG_ARG(a), ASYNC_LOG_MAP_3(__VA_ARGS__)
+#define ASYNC_LOG_MAP_5(a, ...) ASYNC_LOG_ARG(a), ASYNC_LOG_MAP_4(__VA_ARGS__)
+#define ASYNC_LOG_MAP_6(a, ...) ASYNC_LOG_ARG(a), ASYNC_LOG_MAP_5(__VA_ARGS__)
+#define ASYNC_LOG_MAP_7(a, ...) ASYNC_LOG_ARG(a), ASYNC_LOG_MAP_6(__VA_ARGS__)
+#define ASYNC_LOG_MAP_8(a, ...) ASYNC_LOG_ARG(a), ASYNC_LOG_MAP_7(__VA_ARGS__)
+#define ASYNC_LOG_MAP(...) ASYNC_LOG_CAT(ASYNC_LOG_MAP_, ASYNC_LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+/**
+ * Log @param fmt with its arguments at syslog @param level.  Arguments are
+ * checked against the format like printf() arguments, but only evaluated
+ * when @param level is compiled in.
+ */
+#define ASYNC_LOG(level, fmt, ...) \
+    do \
+    { \
+        if(0) \
+        { \
+            printf(fmt, ##__VA_ARGS__); \
+        } \
+        if((level) <= ASYNC_LOG_LEVEL) \
+        { \
+            const struct async_log_arg async_log_args_[] = { \
+                ASYNC_LOG_MAP(__VA_ARGS__) { ASYNC_LOG_ARG_END, { 0 } } \
+            }; \
+            async_log_write((level), (fmt), async_log_args_); \
+        } \
+    } while(0)
+
+#endif /* ASYNC_LOG_H */
@@ -0,0 +1,201 @@
+/**
+ * @file log-bench.c
+ * @brief Cost of a log call to the caller, async-log against printf()
+ *
+ * Every thread logs the same short message with three arguments the given
+ * number of times and measures each call.  The messages go to /dev/null so
+ * only the cost of the logging path is measured, and the async backend is
+ * flushed outside the timed loop.  By default each thread's ring holds all
+ * of its messages, so none are dropped; with a smaller ring set by -r the
+ * logged/s column shows the rate of the calls which were not dropped.
+ *
+ * Usage: log-bench [-t threads] [-n messages_per_thread] [-m async|printf] [-r ring_bytes]
+ */
+
+#include "async-log.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* ring bytes per message, a record of the benchmark message takes 96, see struct log_record in async-log.c */
+#define BENCH_RECORD_SIZE 128
+
+enum bench_mode
+{
+    MODE_ASYNC,
+    MODE_PRINTF,
+};
+
+struct bench_thread
+{
+    pthread_t tid;
+    int index;
+    enum bench_mode mode;
+    FILE *out;
+    unsigned long messages;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+static pthread_barrier_t start_barrier;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void *bench_thread(void *arg)
+{
+    struct bench_thread *thread = (struct bench_thread *)arg;
+    unsigned long i;
+
+    pthread_barrier_wait(&start_barrier);
+    for(i = 0; i < thread->messages; i++)
+    {
+        uint64_t start = now_ns();
+        uint64_t elapsed;
+
+        if(thread->mode == MODE_ASYNC)
+        {
+            ASYNC_LOG(LOG_DEBUG, "log-bench: thread %d message %lu of %s\n", thread->index, i, "bench");
+        }
+        else
+        {
+            fprintf(thread->out, "log-bench: thread %d message %lu of %s\n", thread->index, i, "bench");
+        }
+        elapsed = now_ns() - start;
+        thread->total_ns += elapsed;
+        if(elapsed > thread->max_ns)
+        {
+            thread->max_ns = elapsed;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    struct async_log_config config;
+    struct bench_thread *threads;
+    enum bench_mode mode = MODE_ASYNC;
+    unsigned long messages = 100000;
+    size_t ring_size = 0;
+    unsigned long long dropped = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    FILE *out;
+    int thread_count = 4;
+    int opt;
+    int i;
+
+    while((opt = getopt(argc, argv, "t:n:m:r:")) != -1)
+    {
+        switch(opt)
+        {
+            case 't':
+                thread_count = atoi(optarg);
+                break;
+            case 'n':
+                messages = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                if(strcmp(optarg, "async") == 0)
+                {
+                    mode = MODE_ASYNC;
+                }
+                else if(strcmp(optarg, "printf") == 0)
+                {
+                    mode = MODE_PRINTF;
+                }
+                else
+                {
+                    fprintf(stderr, "Unknown mode %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'r':
+                ring_size = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t threads] [-n messages_per_thread] [-m async|printf] [-r ring_bytes]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(thread_count < 1)
+    {
+        fprintf(stderr, "Need at least one thread\n");
+        return EXIT_FAILURE;
+    }
+
+    out = fopen("/dev/null", "w");
+    threads = calloc(thread_count, sizeof(*threads));
+    if(out == NULL || threads == NULL)
+    {
+        fprintf(stderr, "Failed to set up the benchmark\n");
+        return EXIT_FAILURE;
+    }
+    if(mode == MODE_ASYNC)
+    {
+        memset(&config, 0, sizeof(config));
+        config.sink = ASYNC_LOG_SINK_STREAM;
+        config.stream = out;
+        config.ring_size = ring_size != 0 ? ring_size : messages * BENCH_RECORD_SIZE;
+        async_log_init(&config);
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, thread_count + 1);
+    for(i = 0; i < thread_count; i++)
+    {
+        threads[i].index = i;
+        threads[i].mode = mode;
+        threads[i].out = out;
+        threads[i].messages = messages;
+        if(pthread_create(&threads[i].tid, NULL, bench_thread, &threads[i]) != 0)
+        {
+            fprintf(stderr, "Failed to create thread %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    start = now_ns();
+    pthread_barrier_wait(&start_barrier);
+    for(i = 0; i < thread_count; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        total_ns += threads[i].total_ns;
+        if(threads[i].max_ns > max_ns)
+        {
+            max_ns = threads[i].max_ns;
+        }
+    }
+    elapsed = now_ns() - start;
+    if(mode == MODE_ASYNC)
+    {
+        async_log_flush();
+        dropped = async_log_dropped();
+    }
+
+    printf("%-6s %7s %10s %12s %12s %10s %10s\n", "mode", "threads", "messages", "calls/s", "logged/s", "mean_ns",
+            "max_ns");
+    printf("%-6s %7d %10lu %12.0f %12.0f %10.1f %10llu\n", mode == MODE_ASYNC ? "async" : "printf",
+            thread_count, messages * thread_count, messages * thread_count * 1e9 / (double)elapsed,
+            (messages * thread_count - dropped) * 1e9 / (double)elapsed,
+            total_ns / (double)(messages * thread_count), (unsigned long long)max_ns);
+    if(mode == MODE_ASYNC)
+    {
+        printf("# %llu messages dropped\n", dropped);
+    }
+
+    pthread_barrier_destroy(&start_barrier);
+    free(threads);
+    async_log_shutdown();
+    fclose(out);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,109 @@
+/**
+ * @file exec-profile.c
+ * @brief Run a command through do_execv_profiled() and print where its time went
+ *
+ * The command is run the given number of times.  Every run is printed with
+ * exec_result_print() to stderr and, for more than one run, the median wall,
+ * user and system time follow at the end.
+ *
+ * Usage: exec-profile [-n runs] [-o outputfile] [-f] /absolute/path/to/command [args...]
+ *   -f  also measure the time from execv() to the first output byte
+ */
+
+#include "systemcalls.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t median(uint64_t *values, int count)
+{
+    qsort(values, count, sizeof(*values), compare_u64);
+    return values[count / 2];
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n runs] [-o outputfile] [-f] /absolute/path/to/command [args...]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    const char *outputfile = NULL;
+    unsigned int flags = 0;
+    int runs = 1;
+    int failures = 0;
+    uint64_t *wall;
+    uint64_t *user;
+    uint64_t *sys;
+    int opt;
+    int i;
+
+    // stop at the command so its options are left alone
+    while((opt = getopt(argc, argv, "+n:o:f")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                runs = atoi(optarg);
+                break;
+            case 'o':
+                outputfile = optarg;
+                break;
+            case 'f':
+                flags |= EXEC_PROFILE_FIRST_OUTPUT;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(optind >= argc || runs < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    wall = calloc(runs, sizeof(*wall));
+    user = calloc(runs, sizeof(*user));
+    sys = calloc(runs, sizeof(*sys));
+    if(wall == NULL || user == NULL || sys == NULL)
+    {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+
+    for(i = 0; i < runs; i++)
+    {
+        struct exec_result result;
+        char label[32];
+        bool ok;
+
+        ok = do_execv_profiled(outputfile, &result, flags, &argv[optind]);
+        snprintf(label, sizeof(label), "run %d", i + 1);
+        exec_result_print(stderr, label, &result);
+        if(!ok)
+        {
+            failures++;
+        }
+        wall[i] = result.wall_ns;
+        user[i] = result.user_ns;
+        sys[i] = result.sys_ns;
+    }
+
+    if(runs > 1)
+    {
+        fprintf(stderr, "median of %d runs: wall %.3f ms user %.3f ms sys %.3f ms, %d failed\n", runs,
+                median(wall, runs) / 1e6, median(user, runs) / 1e6, median(sys, runs) / 1e6, failures);
+    }
+    free(wall);
+    free(user);
+    free(sys);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file systemcalls-test.c
+ * @brief Runs commands through the do_exec*_profiled() variants
+ *
+ * Covers a successful command with its resource usage filled in, a program
+ * which does not exist, a command exiting with a non-zero status and the
+ * first output measurement, both for a command which prints and for one
+ * which prints nothing.
+ */
+
+#include "systemcalls.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Like assert() but not compiled out by -DNDEBUG, most checks call the code under test
+ */
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while(0)
+
+/**
+ * Compare the contents of @param path with @param expected
+ */
+static void check_file(const char *path, const char *expected)
+{
+    char contents[256];
+    FILE *file = fopen(path, "r");
+    size_t len;
+
+    CHECK(file != NULL);
+    len = fread(contents, 1, sizeof(contents) - 1, file);
+    fclose(file);
+    contents[len] = '\0';
+    CHECK(strcmp(contents, expected) == 0);
+}
+
+static void check_success(const char *outputfile)
+{
+    struct exec_result result;
+    bool ok;
+
+    ok = do_exec_redirect_profiled(outputfile, &result, EXEC_PROFILE_FIRST_OUTPUT, 3, "/bin/echo", "hello", "world");
+    CHECK(ok);
+    CHECK(WIFEXITED(result.status) && WEXITSTATUS(result.status) == 0);
+    CHECK(result.exec_errno == 0);
+    CHECK(result.exec_ns > 0 && result.wall_ns >= result.exec_ns);
+    CHECK(result.first_output_ns >= 0);
+    // wait4() filled the rusage of the child
+    CHECK(result.max_rss_kb > 0);
+    CHECK(result.minor_faults > 0);
+    // the output passed through the first output pipe unchanged
+    check_file(outputfile, "hello world\n");
+    printf("test successful -> /bin/echo with first output\n");
+
+    ok = do_exec_profiled(&result, 0, 1, "/bin/true");
+    CHECK(ok);
+    CHECK(result.first_output_ns == -1);
+    CHECK(result.max_rss_kb > 0);
+    printf("test successful -> /bin/true\n");
+}
+
+static void check_missing_program(void)
+{
+    struct exec_result result;
+    bool ok;
+
+    ok = do_exec_profiled(&result, 0, 1, "/nonexistent/command");
+    CHECK(!ok);
+    CHECK(result.exec_errno == ENOENT);
+    CHECK(WIFEXITED(result.status) && WEXITSTATUS(result.status) == 127);
+    printf("test successful -> missing program reports ENOENT\n");
+}
+
+static void check_exit_status(void)
+{
+    struct exec_result result;
+    bool ok;
+
+    ok = do_exec_profiled(&result, 0, 3, "/bin/sh", "-c", "exit 3");
+    CHECK(!ok);
+    CHECK(result.exec_errno == 0);
+    CHECK(WIFEXITED(result.status) && WEXITSTATUS(result.status) == 3);
+    printf("test successful -> exit status 3\n");
+}
+
+static void check_no_output(const char *outputfile)
+{
+    struct exec_result result;
+    bool ok;
+
+    ok = do_exec_redirect_profiled(outputfile, &result, EXEC_PROFILE_FIRST_OUTPUT, 1, "/bin/true");
+    CHECK(ok);
+    CHECK(result.first_output_ns == -1);
+    check_file(outputfile, "");
+    printf("test successful -> first output of a command printing nothing\n");
+}
+
+int main(int argc, char **argv)
+{
+    char outputfile[] = "/tmp/systemcalls-test.XXXXXX";
+    int fd = mkstemp(outputfile);
+
+    CHECK(fd >= 0);
+    close(fd);
+    check_success(outputfile);
+    check_missing_program();
+    check_exit_status();
+    check_no_output(outputfile);
+    unlink(outputfile);
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,11 @@
+#define _GNU_SOURCE
 #include "systemcalls.h"
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -162,3 +168,248 @@ bool do_exec_redirect(const char *outputfile, int count, ...)
 
     return true;
 }
+
+static uint64_t exec_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t timeval_ns(const struct timeval *tv)
+{
+    return (uint64_t)tv->tv_sec * 1000000000ull + (uint64_t)tv->tv_usec * 1000ull;
+}
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if(n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(n <= 0)
+        {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+ * A close-on-exec pipe tells the parent when execv() succeeded, or carries
+ * its errno if it failed.  With EXEC_PROFILE_FIRST_OUTPUT the child's stdout
+ * is a second pipe which the parent copies to the real destination while
+ * noting the arrival of the first byte.
+ */
+bool do_execv_profiled(const char *outputfile, struct exec_result *result, unsigned int flags,
+        char *const command[])
+{
+    int exec_pipe[2];
+    int out_pipe[2] = {-1, -1};
+    int out_fd = STDOUT_FILENO;
+    int child_errno = 0;
+    struct rusage usage;
+    uint64_t start;
+    uint64_t exec_done;
+    pid_t pid;
+    ssize_t n;
+
+    memset(result, 0, sizeof(*result));
+    result->status = -1;
+    result->first_output_ns = -1;
+
+    if(outputfile != NULL)
+    {
+        out_fd = open(outputfile, O_WRONLY|O_TRUNC|O_CREAT|O_CLOEXEC, 0644);
+        if(out_fd < 0)
+        {
+            return false;
+        }
+    }
+    if(pipe2(exec_pipe, O_CLOEXEC) != 0)
+    {
+        goto close_out;
+    }
+    if((flags & EXEC_PROFILE_FIRST_OUTPUT) && pipe2(out_pipe, O_CLOEXEC) != 0)
+    {
+        goto close_exec_pipe;
+    }
+
+    // anything buffered would otherwise be written twice
+    fflush(stdout);
+    start = exec_now_ns();
+    pid = fork();
+    if(pid == 0)
+    {
+        // child, dup2() clears close-on-exec on the new descriptor
+        int target = out_pipe[1] >= 0 ? out_pipe[1] : out_fd;
+        if(target != STDOUT_FILENO && dup2(target, STDOUT_FILENO) < 0)
+        {
+            child_errno = errno;
+        }
+        else
+        {
+            execv(command[0], command);
+            child_errno = errno;
+        }
+        write_all(exec_pipe[1], (const char *)&child_errno, sizeof(child_errno));
+        _exit(127);
+    }
+    if(pid < 0)
+    {
+        goto close_out_pipe;
+    }
+
+    close(exec_pipe[1]);
+    exec_pipe[1] = -1;
+    if(out_pipe[1] >= 0)
+    {
+        close(out_pipe[1]);
+        out_pipe[1] = -1;
+    }
+
+    // end of file on the exec pipe means execv() succeeded
+    do
+    {
+        n = read(exec_pipe[0], &child_errno, sizeof(child_errno));
+    } while(n < 0 && errno == EINTR);
+    exec_done = exec_now_ns();
+    result->exec_ns = exec_done - start;
+    if(n == sizeof(child_errno))
+    {
+        result->exec_errno = child_errno;
+    }
+
+    if(out_pipe[0] >= 0)
+    {
+        char buf[4096];
+        bool copy = true;
+
+        while((n = read(out_pipe[0], buf, sizeof(buf))) != 0)
+        {
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            if(result->first_output_ns < 0)
+            {
+                result->first_output_ns = (int64_t)(exec_now_ns() - exec_done);
+            }
+            // keep draining after a write error so the child does not block
+            if(copy && !write_all(out_fd, buf, n))
+            {
+                copy = false;
+            }
+        }
+    }
+
+    while(wait4(pid, &result->status, 0, &usage) < 0)
+    {
+        if(errno != EINTR)
+        {
+            result->status = -1;
+            goto close_out_pipe;
+        }
+    }
+    result->wall_ns = exec_now_ns() - start;
+    result->user_ns = timeval_ns(&usage.ru_utime);
+    result->sys_ns = timeval_ns(&usage.ru_stime);
+    result->max_rss_kb = usage.ru_maxrss;
+    result->voluntary_ctxt_switches = usage.ru_nvcsw;
+    result->involuntary_ctxt_switches = usage.ru_nivcsw;
+    result->minor_faults = usage.ru_minflt;
+    result->major_faults = usage.ru_majflt;
+
+close_out_pipe:
+    if(out_pipe[0] >= 0)
+    {
+        close(out_pipe[0]);
+    }
+    if(out_pipe[1] >= 0)
+    {
+        close(out_pipe[1]);
+    }
+close_exec_pipe:
+    close(exec_pipe[0]);
+    if(exec_pipe[1] >= 0)
+    {
+        close(exec_pipe[1]);
+    }
+close_out:
+    if(out_fd != STDOUT_FILENO)
+    {
+        close(out_fd);
+    }
+    return result->status >= 0 && result->exec_errno == 0
+        && WIFEXITED(result->status) && WEXITSTATUS(result->status) == 0;
+}
+
+/**
+* @param result - Filled with the timing and resource usage of the command
+* @param flags - EXEC_PROFILE_* options
+* All other parameters, see do_exec above
+*/
+bool do_exec_profiled(struct exec_result *result, unsigned int flags, int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char * command[count+1];
+    int i;
+    for(i=0; i<count; i++)
+    {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
+
+    return do_execv_profiled(NULL, result, flags, command);
+}
+
+/**
+* @param outputfile - The full path to the file to write with command output.
+* All other parameters, see do_exec_profiled above
+*/
+bool do_exec_redirect_profiled(const char *outputfile, struct exec_result *result, unsigned int flags,
+        int count, ...)
+{
+    va_list args;
+    va_start(args, count);
+    char * command[count+1];
+    int i;
+    for(i=0; i<count; i++)
+    {
+        command[i] = va_arg(args, char *);
+    }
+    command[count] = NULL;
+    va_end(args);
+
+    return do_execv_profiled(outputfile, result, flags, command);
+}
+
+void exec_result_print(FILE *stream, const char *label, const struct exec_result *result)
+{
+    fprintf(stream, "%s: status %d wall %.3f ms exec %.3f ms user %.3f ms sys %.3f ms maxrss %ld KiB "
+            "csw %ld/%ld faults %ld/%ld",
+            label, result->status, result->wall_ns / 1e6, result->exec_ns / 1e6,
+            result->user_ns / 1e6, result->sys_ns / 1e6, result->max_rss_kb,
+            result->voluntary_ctxt_switches, result->involuntary_ctxt_switches,
+            result->minor_faults, result->major_faults);
+    if(result->first_output_ns >= 0)
+    {
+        fprintf(stream, " first output %.3f ms", result->first_output_ns / 1e6);
+    }
+    if(result->exec_errno != 0)
+    {
+        fprintf(stream, " exec failed: %s", strerror(result->exec_errno));
+    }
+    fputc('\n', stream);
+}
@@ -1,9 +1,76 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 bool do_system(const char *command);
 
 bool do_exec(int count, ...);
 
 bool do_exec_redirect(const char *outputfile, int count, ...);
+
+/**
+ * Also measure the time from execv() to the first byte the command writes
+ * to stdout.  stdout is then passed through a pipe read by the caller.
+ */
+#define EXEC_PROFILE_FIRST_OUTPUT 0x1
+
+/**
+ * Timing and resource usage of a command run by do_exec_profiled()
+ */
+struct exec_result
+{
+    /**
+     * Wait status as returned by wait4(), -1 if the command was not started
+     */
+    int status;
+    /**
+     * errno of a failed execv() in the child, 0 otherwise
+     */
+    int exec_errno;
+    /**
+     * Nanoseconds from fork() until the child was reaped
+     */
+    uint64_t wall_ns;
+    /**
+     * Nanoseconds from fork() until execv() replaced the child
+     */
+    uint64_t exec_ns;
+    /**
+     * Nanoseconds from execv() to the first output byte, -1 if not measured or no output
+     */
+    int64_t first_output_ns;
+    uint64_t user_ns;
+    uint64_t sys_ns;
+    long max_rss_kb;
+    long voluntary_ctxt_switches;
+    long involuntary_ctxt_switches;
+    long minor_faults;
+    long major_faults;
+};
+
+/**
+ * Run @param command, a NULL terminated argument vector starting with the
+ * absolute path of the program, with stdout redirected to @param outputfile
+ * unless it is NULL.  The child is reaped with wait4() to fill @param result.
+ * @param flags EXEC_PROFILE_* options
+ * @return true if the command ran and exited with status 0
+ */
+bool do_execv_profiled(const char *outputfile, struct exec_result *result, unsigned int flags,
+        char *const command[]);
+
+/**
+ * do_exec() which also fills @param result, see EXEC_PROFILE_* for @param flags
+ */
+bool do_exec_profiled(struct exec_result *result, unsigned int flags, int count, ...);
+
+/**
+ * do_exec_redirect() which also fills @param result, see EXEC_PROFILE_* for @param flags
+ */
+bool do_exec_redirect_profiled(const char *outputfile, struct exec_result *result, unsigned int flags,
+        int count, ...);
+
+/**
+ * Print @param result on one line to @param stream, prefixed with @param label
+ */
+void exec_result_print(FILE *stream, const char *label, const struct exec_result *result);
@@ -0,0 +1,440 @@
+/**
+ * @file lock-bench.c
+ * @brief Contention benchmark for the lock types in lock-profiler.h
+ *
+ * For every lock type, thread count and hold time the benchmark starts the
+ * threads, lets each of them repeatedly acquire the shared lock, busy wait for
+ * the hold time and release it, and prints throughput together with the wait
+ * time percentiles recorded by the profiled lock.
+ *
+ * With -p the runs are repeated for each thread placement: "none" leaves
+ * the threads to the scheduler, "compact" pins thread i to the i-th CPU with
+ * sockets and cores filled up first, and "spread" pins consecutive threads to
+ * different sockets, then different cores, so the lock's cache line has to
+ * travel as far as possible.  The spread between wait_p50 and wait_max shows
+ * the jitter each placement adds.  -n binds the lock to one NUMA node, which
+ * together with -p spread measures the cost of contending across sockets.
+ *
+ * Usage: lock-bench [-l mutex,spinpark,ticket,mcs] [-t max_threads]
+ *                   [-H hold_ns,...] [-w think_ns] [-d duration_ms]
+ *                   [-p none,compact,spread] [-P other|fifo:prio|rr:prio]
+ *                   [-n lock_node] [-v]
+ */
+
+#include "thread-attr.h"
+#include "lock-profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_LIST_ENTRIES 16
+
+enum bench_placement
+{
+    PLACEMENT_NONE,
+    PLACEMENT_COMPACT,
+    PLACEMENT_SPREAD,
+    PLACEMENT_COUNT
+};
+
+static const char *const placement_names[PLACEMENT_COUNT] = { "none", "compact", "spread" };
+
+struct bench_config
+{
+    enum lock_type types[LOCK_TYPE_COUNT];
+    int type_count;
+    int max_threads;
+    uint64_t hold_ns[MAX_LIST_ENTRIES];
+    int hold_count;
+    uint64_t think_ns;
+    unsigned int duration_ms;
+    enum bench_placement placements[PLACEMENT_COUNT];
+    int placement_count;
+    /* scheduling policy and priority of the benchmark threads */
+    struct thread_attr sched;
+    /* NUMA node holding the lock, -1 to leave it to the kernel */
+    int lock_node;
+    bool verbose;
+};
+
+struct bench_run
+{
+    struct profiled_lock lock;
+    uint64_t hold_ns;
+    uint64_t think_ns;
+    atomic_bool start;
+    atomic_bool stop;
+    /* protected by lock, used to check mutual exclusion */
+    uint64_t shared_counter;
+    atomic_uint_fast64_t ops;
+    atomic_int errors;
+};
+
+struct bench_thread
+{
+    struct bench_run *run;
+    struct thread_attr attr;
+};
+
+static void busy_wait_ns(uint64_t ns)
+{
+    uint64_t end;
+
+    if(ns == 0)
+    {
+        return;
+    }
+    end = lock_profiler_now_ns() + ns;
+    while(lock_profiler_now_ns() < end)
+    {
+    }
+}
+
+static void *bench_thread(void *arg)
+{
+    struct bench_thread *thread = (struct bench_thread *)arg;
+    struct bench_run *run = thread->run;
+    uint64_t ops = 0;
+
+    thread_attr_apply_self(&thread->attr);
+
+    while(!atomic_load_explicit(&run->start, memory_order_acquire))
+    {
+        sched_yield();
+    }
+
+    while(!atomic_load_explicit(&run->stop, memory_order_relaxed))
+    {
+        if(profiled_lock_acquire(&run->lock) != 0)
+        {
+            atomic_fetch_add(&run->errors, 1);
+            break;
+        }
+        run->shared_counter++;
+        busy_wait_ns(run->hold_ns);
+        profiled_lock_release(&run->lock);
+        ops++;
+        busy_wait_ns(run->think_ns);
+    }
+
+    atomic_fetch_add(&run->ops, ops);
+    return NULL;
+}
+
+/**
+ * Fill @param attrs for @param threads threads placed according to @param placement
+ */
+static void place_threads(const struct bench_config *config, enum bench_placement placement,
+        struct bench_thread *attrs, int threads)
+{
+    int order[CPU_SETSIZE];
+    int cpus = 0;
+    int i;
+
+    if(placement != PLACEMENT_NONE)
+    {
+        cpus = thread_attr_cpu_order(placement == PLACEMENT_SPREAD ? CPU_PLACEMENT_SPREAD : CPU_PLACEMENT_COMPACT,
+                order, CPU_SETSIZE);
+    }
+    for(i = 0; i < threads; i++)
+    {
+        attrs[i].attr = config->sched;
+        if(cpus > 0)
+        {
+            int cpu = order[i % cpus];
+            thread_attr_add_cpu(&attrs[i].attr, cpu);
+            attrs[i].attr.numa_node = numa_node_of_cpu(cpu);
+        }
+    }
+}
+
+/**
+ * Allocate the shared state of a run on its own pages, bound to config->lock_node if set
+ */
+static struct bench_run *alloc_run(const struct bench_config *config)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (sizeof(struct bench_run) + page - 1) / page * page;
+    struct bench_run *run = aligned_alloc(page, size);
+    int rc;
+
+    if(run == NULL)
+    {
+        return NULL;
+    }
+    if(config->lock_node >= 0)
+    {
+        rc = numa_bind_memory(run, size, config->lock_node);
+        if(rc != 0)
+        {
+            fprintf(stderr, "Failed to bind lock to node %d: %s\n", config->lock_node, strerror(rc));
+        }
+    }
+    memset(run, 0, sizeof(*run));
+    return run;
+}
+
+static bool run_one(const struct bench_config *config, enum lock_type type, enum bench_placement placement,
+        int threads, uint64_t hold_ns)
+{
+    struct bench_run *run = alloc_run(config);
+    struct bench_thread args[threads];
+    pthread_t tids[threads];
+    pthread_attr_t pattr;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t ops;
+    int created;
+    int rc;
+    int i;
+
+    if(run == NULL)
+    {
+        fprintf(stderr, "Failed to allocate the benchmark state\n");
+        return false;
+    }
+    if(profiled_lock_init(&run->lock, type, lock_type_name(type)) != 0)
+    {
+        fprintf(stderr, "Failed to initialize %s lock\n", lock_type_name(type));
+        free(run);
+        return false;
+    }
+    run->hold_ns = hold_ns;
+    run->think_ns = config->think_ns;
+    place_threads(config, placement, args, threads);
+
+    for(created = 0; created < threads; created++)
+    {
+        args[created].run = run;
+        rc = pthread_attr_init(&pattr);
+        if(rc == 0)
+        {
+            rc = thread_attr_to_pthread(&args[created].attr, &pattr);
+            if(rc == 0)
+            {
+                rc = pthread_create(&tids[created], &pattr, bench_thread, &args[created]);
+            }
+            pthread_attr_destroy(&pattr);
+        }
+        if(rc != 0)
+        {
+            fprintf(stderr, "Failed to create thread %d: %s\n", created, strerror(rc));
+            break;
+        }
+    }
+
+    start = lock_profiler_now_ns();
+    atomic_store_explicit(&run->start, true, memory_order_release);
+    usleep(config->duration_ms * 1000);
+    atomic_store(&run->stop, true);
+
+    for(i = 0; i < created; i++)
+    {
+        pthread_join(tids[i], NULL);
+    }
+    elapsed = lock_profiler_now_ns() - start;
+    ops = atomic_load(&run->ops);
+
+    if(run->shared_counter != ops || atomic_load(&run->errors) != 0)
+    {
+        fprintf(stderr, "%s: mutual exclusion violated (%llu increments for %llu ops, %d errors)\n",
+                lock_type_name(type), (unsigned long long)run->shared_counter,
+                (unsigned long long)ops, atomic_load(&run->errors));
+    }
+
+    printf("%-9s %-7s %7d %9llu %12.0f %10llu %10llu %10llu %10llu %10llu\n",
+            lock_type_name(type), placement_names[placement], created, (unsigned long long)hold_ns,
+            ops * 1e9 / (double)elapsed,
+            (unsigned long long)lock_histogram_percentile(&run->lock.wait_hist, 50.0),
+            (unsigned long long)lock_histogram_percentile(&run->lock.wait_hist, 99.0),
+            (unsigned long long)lock_histogram_percentile(&run->lock.wait_hist, 99.9),
+            (unsigned long long)atomic_load(&run->lock.wait_hist.max_ns),
+            (unsigned long long)lock_histogram_percentile(&run->lock.hold_hist, 50.0));
+
+    if(config->verbose)
+    {
+        profiled_lock_report(&run->lock, stdout);
+    }
+
+    profiled_lock_destroy(&run->lock);
+    free(run);
+    return created == threads;
+}
+
+static int parse_u64_list(char *arg, uint64_t *values)
+{
+    int count = 0;
+    char *saveptr = NULL;
+    char *token;
+
+    for(token = strtok_r(arg, ",", &saveptr); token != NULL && count < MAX_LIST_ENTRIES;
+            token = strtok_r(NULL, ",", &saveptr))
+    {
+        values[count++] = strtoull(token, NULL, 0);
+    }
+    return count;
+}
+
+static bool parse_lock_types(char *arg, struct bench_config *config)
+{
+    char *saveptr = NULL;
+    char *token;
+
+    config->type_count = 0;
+    for(token = strtok_r(arg, ",", &saveptr); token != NULL;
+            token = strtok_r(NULL, ",", &saveptr))
+    {
+        if(config->type_count >= LOCK_TYPE_COUNT
+                || !lock_type_from_name(token, &config->types[config->type_count]))
+        {
+            fprintf(stderr, "Unknown lock type %s\n", token);
+            return false;
+        }
+        config->type_count++;
+    }
+    return config->type_count > 0;
+}
+
+static bool parse_placements(char *arg, struct bench_config *config)
+{
+    char *saveptr = NULL;
+    char *token;
+    int p;
+
+    config->placement_count = 0;
+    for(token = strtok_r(arg, ",", &saveptr); token != NULL;
+            token = strtok_r(NULL, ",", &saveptr))
+    {
+        for(p = 0; p < PLACEMENT_COUNT; p++)
+        {
+            if(strcmp(token, placement_names[p]) == 0)
+            {
+                break;
+            }
+        }
+        if(p == PLACEMENT_COUNT || config->placement_count >= PLACEMENT_COUNT)
+        {
+            fprintf(stderr, "Unknown placement %s\n", token);
+            return false;
+        }
+        config->placements[config->placement_count++] = (enum bench_placement)p;
+    }
+    return config->placement_count > 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-l mutex,spinpark,ticket,mcs] [-t max_threads] "
+            "[-H hold_ns,...] [-w think_ns] [-d duration_ms] [-p none,compact,spread] "
+            "[-P other|fifo:prio|rr:prio] [-n lock_node] [-v]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_config config;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    int t;
+    int h;
+    int l;
+    int p;
+    bool ok = true;
+
+    memset(&config, 0, sizeof(config));
+    for(l = 0; l < LOCK_TYPE_COUNT; l++)
+    {
+        config.types[l] = (enum lock_type)l;
+    }
+    config.type_count = LOCK_TYPE_COUNT;
+    config.max_threads = (cpus > 0) ? (int)cpus * 2 : 2;
+    config.hold_ns[0] = 0;
+    config.hold_ns[1] = 100;
+    config.hold_ns[2] = 1000;
+    config.hold_ns[3] = 10000;
+    config.hold_count = 4;
+    config.duration_ms = 200;
+    config.placements[0] = PLACEMENT_NONE;
+    config.placement_count = 1;
+    thread_attr_init(&config.sched);
+    config.lock_node = -1;
+
+    while((opt = getopt(argc, argv, "l:t:H:w:d:p:P:n:v")) != -1)
+    {
+        switch(opt)
+        {
+            case 'l':
+                if(!parse_lock_types(optarg, &config))
+                {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                config.max_threads = atoi(optarg);
+                break;
+            case 'H':
+                config.hold_count = parse_u64_list(optarg, config.hold_ns);
+                break;
+            case 'w':
+                config.think_ns = strtoull(optarg, NULL, 0);
+                break;
+            case 'd':
+                config.duration_ms = (unsigned int)atoi(optarg);
+                break;
+            case 'p':
+                if(!parse_placements(optarg, &config))
+                {
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'P':
+                if(!thread_attr_parse_sched(&config.sched, optarg))
+                {
+                    fprintf(stderr, "Invalid scheduling policy %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                config.lock_node = atoi(optarg);
+                break;
+            case 'v':
+                config.verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(config.max_threads < 1 || config.hold_count < 1 || config.duration_ms == 0)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("# %ld online cpus on %d numa nodes, %u ms per run, think time %llu ns\n",
+            cpus, numa_node_count(), config.duration_ms, (unsigned long long)config.think_ns);
+    if(config.lock_node >= 0)
+    {
+        printf("# lock bound to numa node %d\n", config.lock_node);
+    }
+    printf("%-9s %-7s %7s %9s %12s %10s %10s %10s %10s %10s\n",
+            "lock", "place", "threads", "hold_ns", "ops/s", "wait_p50", "wait_p99", "wait_p999",
+            "wait_max", "hold_p50");
+
+    for(l = 0; l < config.type_count; l++)
+    {
+        for(p = 0; p < config.placement_count; p++)
+        {
+            for(h = 0; h < config.hold_count; h++)
+            {
+                for(t = 1; t <= config.max_threads; t *= 2)
+                {
+                    ok = run_one(&config, config.types[l], config.placements[p], t, config.hold_ns[h]) && ok;
+                }
+            }
+        }
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
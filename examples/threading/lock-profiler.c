@@ -0,0 +1,406 @@
+/**
+ * @file lock-profiler.c
+ * @brief Instrumented pthread mutex, spin-then-park, ticket and MCS locks
+ *
+ * Each acquire records the time spent waiting and each release the time the
+ * lock was held into power of two histograms stored with the lock.
+ */
+
+#include "lock-profiler.h"
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/*
+ * Spinning waiters call sched_yield() after this many relax iterations so the
+ * holder can make progress when there are more threads than CPUs.
+ */
+#define SPIN_YIELD_INTERVAL 1024
+
+static const char *lock_type_names[LOCK_TYPE_COUNT] = {
+    [LOCK_TYPE_PTHREAD_MUTEX] = "mutex",
+    [LOCK_TYPE_SPIN_THEN_PARK] = "spinpark",
+    [LOCK_TYPE_TICKET] = "ticket",
+    [LOCK_TYPE_MCS] = "mcs",
+};
+
+static __thread struct mcs_node mcs_nodes[LOCK_MCS_MAX_NESTING];
+static __thread int mcs_depth;
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield" ::: "memory");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+static inline void spin_wait(unsigned int *spins)
+{
+    if(++(*spins) % SPIN_YIELD_INTERVAL == 0)
+    {
+        sched_yield();
+    }
+    else
+    {
+        cpu_relax();
+    }
+}
+
+static long futex(atomic_int *uaddr, int op, int val)
+{
+    return syscall(SYS_futex, uaddr, op, val, NULL, NULL, 0);
+}
+
+uint64_t lock_profiler_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static unsigned int histogram_bucket(uint64_t ns)
+{
+    unsigned int bucket;
+
+    if(ns == 0)
+    {
+        return 0;
+    }
+    bucket = 64 - __builtin_clzll(ns);
+    if(bucket >= LOCK_HISTOGRAM_BUCKETS)
+    {
+        bucket = LOCK_HISTOGRAM_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+static void histogram_record(struct lock_histogram *hist, uint64_t ns)
+{
+    uint64_t max = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&hist->bucket[histogram_bucket(ns)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->total_ns, ns, memory_order_relaxed);
+    while(ns > max)
+    {
+        if(atomic_compare_exchange_weak_explicit(&hist->max_ns, &max, ns,
+                    memory_order_relaxed, memory_order_relaxed))
+        {
+            break;
+        }
+    }
+}
+
+static void histogram_reset(struct lock_histogram *hist)
+{
+    int i;
+
+    for(i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++)
+    {
+        atomic_store_explicit(&hist->bucket[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&hist->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->total_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&hist->max_ns, 0, memory_order_relaxed);
+}
+
+uint64_t lock_histogram_percentile(const struct lock_histogram *hist, double percentile)
+{
+    uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&hist->max_ns, memory_order_relaxed);
+    uint64_t target;
+    uint64_t seen = 0;
+    int i;
+
+    if(count == 0)
+    {
+        return 0;
+    }
+    target = (uint64_t)((percentile / 100.0) * count);
+    if(target == 0)
+    {
+        target = 1;
+    }
+    for(i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&hist->bucket[i], memory_order_relaxed);
+        if(seen >= target)
+        {
+            uint64_t upper = (i == 0) ? 0 : (1ull << i) - 1;
+            return (upper < max) ? upper : max;
+        }
+    }
+    return max;
+}
+
+int profiled_lock_init(struct profiled_lock *lock, enum lock_type type, const char *name)
+{
+    memset(lock, 0, sizeof(*lock));
+    lock->type = type;
+    lock->name = name;
+
+    switch(type)
+    {
+        case LOCK_TYPE_PTHREAD_MUTEX:
+            return pthread_mutex_init(&lock->u.mutex, NULL);
+        case LOCK_TYPE_SPIN_THEN_PARK:
+            atomic_init(&lock->u.spin_park.state, 0);
+            lock->u.spin_park.spin_limit = LOCK_DEFAULT_SPIN_LIMIT;
+            return 0;
+        case LOCK_TYPE_TICKET:
+            atomic_init(&lock->u.ticket.next, 0);
+            atomic_init(&lock->u.ticket.serving, 0);
+            return 0;
+        case LOCK_TYPE_MCS:
+            atomic_init(&lock->u.mcs.tail, NULL);
+            lock->u.mcs.owner = NULL;
+            return 0;
+        default:
+            return EINVAL;
+    }
+}
+
+int profiled_lock_destroy(struct profiled_lock *lock)
+{
+    if(lock->type == LOCK_TYPE_PTHREAD_MUTEX)
+    {
+        return pthread_mutex_destroy(&lock->u.mutex);
+    }
+    return 0;
+}
+
+static void spin_park_lock(struct profiled_lock *lock)
+{
+    atomic_int *state = &lock->u.spin_park.state;
+    unsigned int spins = 0;
+    int c = 0;
+    int i;
+
+    for(i = 0; i < lock->u.spin_park.spin_limit; i++)
+    {
+        c = 0;
+        if(atomic_compare_exchange_weak_explicit(state, &c, 1,
+                    memory_order_acquire, memory_order_relaxed))
+        {
+            return;
+        }
+        spin_wait(&spins);
+    }
+
+    if(c != 2)
+    {
+        c = atomic_exchange_explicit(state, 2, memory_order_acquire);
+    }
+    while(c != 0)
+    {
+        futex(state, FUTEX_WAIT_PRIVATE, 2);
+        c = atomic_exchange_explicit(state, 2, memory_order_acquire);
+    }
+}
+
+static void spin_park_unlock(struct profiled_lock *lock)
+{
+    atomic_int *state = &lock->u.spin_park.state;
+
+    if(atomic_fetch_sub_explicit(state, 1, memory_order_release) != 1)
+    {
+        atomic_store_explicit(state, 0, memory_order_release);
+        futex(state, FUTEX_WAKE_PRIVATE, 1);
+    }
+}
+
+static void ticket_lock(struct profiled_lock *lock)
+{
+    unsigned int ticket = atomic_fetch_add_explicit(&lock->u.ticket.next, 1, memory_order_relaxed);
+    unsigned int spins = 0;
+
+    while(atomic_load_explicit(&lock->u.ticket.serving, memory_order_acquire) != ticket)
+    {
+        spin_wait(&spins);
+    }
+}
+
+static void ticket_unlock(struct profiled_lock *lock)
+{
+    unsigned int serving = atomic_load_explicit(&lock->u.ticket.serving, memory_order_relaxed);
+    atomic_store_explicit(&lock->u.ticket.serving, serving + 1, memory_order_release);
+}
+
+static int mcs_lock(struct profiled_lock *lock)
+{
+    struct mcs_node *node;
+    struct mcs_node *pred;
+    unsigned int spins = 0;
+
+    if(mcs_depth >= LOCK_MCS_MAX_NESTING)
+    {
+        return EAGAIN;
+    }
+    node = &mcs_nodes[mcs_depth++];
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, true, memory_order_relaxed);
+
+    pred = atomic_exchange_explicit(&lock->u.mcs.tail, node, memory_order_acq_rel);
+    if(pred != NULL)
+    {
+        atomic_store_explicit(&pred->next, node, memory_order_release);
+        while(atomic_load_explicit(&node->locked, memory_order_acquire))
+        {
+            spin_wait(&spins);
+        }
+    }
+    lock->u.mcs.owner = node;
+    return 0;
+}
+
+static void mcs_unlock(struct profiled_lock *lock)
+{
+    struct mcs_node *node = lock->u.mcs.owner;
+    struct mcs_node *succ = atomic_load_explicit(&node->next, memory_order_acquire);
+    unsigned int spins = 0;
+
+    if(succ == NULL)
+    {
+        struct mcs_node *expected = node;
+        if(atomic_compare_exchange_strong_explicit(&lock->u.mcs.tail, &expected, NULL,
+                    memory_order_acq_rel, memory_order_relaxed))
+        {
+            mcs_depth--;
+            return;
+        }
+        // a waiter swapped itself in but has not linked to us yet
+        while((succ = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL)
+        {
+            spin_wait(&spins);
+        }
+    }
+    atomic_store_explicit(&succ->locked, false, memory_order_release);
+    mcs_depth--;
+}
+
+int profiled_lock_acquire(struct profiled_lock *lock)
+{
+    uint64_t start = lock_profiler_now_ns();
+    uint64_t now;
+    int rc = 0;
+
+    switch(lock->type)
+    {
+        case LOCK_TYPE_PTHREAD_MUTEX:
+            rc = pthread_mutex_lock(&lock->u.mutex);
+            break;
+        case LOCK_TYPE_SPIN_THEN_PARK:
+            spin_park_lock(lock);
+            break;
+        case LOCK_TYPE_TICKET:
+            ticket_lock(lock);
+            break;
+        case LOCK_TYPE_MCS:
+            rc = mcs_lock(lock);
+            break;
+        default:
+            rc = EINVAL;
+            break;
+    }
+
+    if(rc != 0)
+    {
+        return rc;
+    }
+
+    now = lock_profiler_now_ns();
+    histogram_record(&lock->wait_hist, now - start);
+    lock->acquired_at_ns = now;
+    return 0;
+}
+
+int profiled_lock_release(struct profiled_lock *lock)
+{
+    histogram_record(&lock->hold_hist, lock_profiler_now_ns() - lock->acquired_at_ns);
+
+    switch(lock->type)
+    {
+        case LOCK_TYPE_PTHREAD_MUTEX:
+            return pthread_mutex_unlock(&lock->u.mutex);
+        case LOCK_TYPE_SPIN_THEN_PARK:
+            spin_park_unlock(lock);
+            return 0;
+        case LOCK_TYPE_TICKET:
+            ticket_unlock(lock);
+            return 0;
+        case LOCK_TYPE_MCS:
+            mcs_unlock(lock);
+            return 0;
+        default:
+            return EINVAL;
+    }
+}
+
+void profiled_lock_reset_stats(struct profiled_lock *lock)
+{
+    histogram_reset(&lock->wait_hist);
+    histogram_reset(&lock->hold_hist);
+}
+
+static void histogram_report(const char *label, const struct lock_histogram *hist, FILE *out)
+{
+    uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+    uint64_t total = atomic_load_explicit(&hist->total_ns, memory_order_relaxed);
+    int i;
+
+    fprintf(out, "  %s: count %llu mean %llu ns p50 %llu ns p99 %llu ns max %llu ns\n",
+            label, (unsigned long long)count,
+            (unsigned long long)(count ? total / count : 0),
+            (unsigned long long)lock_histogram_percentile(hist, 50.0),
+            (unsigned long long)lock_histogram_percentile(hist, 99.0),
+            (unsigned long long)atomic_load_explicit(&hist->max_ns, memory_order_relaxed));
+
+    for(i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++)
+    {
+        uint64_t n = atomic_load_explicit(&hist->bucket[i], memory_order_relaxed);
+        if(n != 0)
+        {
+            fprintf(out, "    < %llu ns: %llu\n",
+                    (unsigned long long)(i == 0 ? 1 : 1ull << i), (unsigned long long)n);
+        }
+    }
+}
+
+void profiled_lock_report(const struct profiled_lock *lock, FILE *out)
+{
+    fprintf(out, "lock %s (%s)\n", lock->name ? lock->name : "<unnamed>", lock_type_name(lock->type));
+    histogram_report("wait", &lock->wait_hist, out);
+    histogram_report("hold", &lock->hold_hist, out);
+}
+
+const char *lock_type_name(enum lock_type type)
+{
+    if(type < 0 || type >= LOCK_TYPE_COUNT)
+    {
+        return "unknown";
+    }
+    return lock_type_names[type];
+}
+
+bool lock_type_from_name(const char *name, enum lock_type *type)
+{
+    int i;
+
+    for(i = 0; i < LOCK_TYPE_COUNT; i++)
+    {
+        if(strcmp(name, lock_type_names[i]) == 0)
+        {
+            *type = (enum lock_type)i;
+            return true;
+        }
+    }
+    return false;
+}
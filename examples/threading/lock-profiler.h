@@ -0,0 +1,164 @@
+/*
+ * lock-profiler.h
+ *
+ * Instrumented lock wrappers used by the threading example.  Every
+ * struct profiled_lock records how long callers waited to acquire it
+ * and how long it was held, so different locking primitives can be
+ * compared against the same workload.
+ */
+
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * The locking primitive backing a struct profiled_lock
+ */
+enum lock_type
+{
+    LOCK_TYPE_PTHREAD_MUTEX,    /* plain pthread_mutex_t */
+    LOCK_TYPE_SPIN_THEN_PARK,   /* spin for a bounded number of tries, then sleep on a futex */
+    LOCK_TYPE_TICKET,           /* FIFO ticket spinlock */
+    LOCK_TYPE_MCS,              /* MCS queue lock, each waiter spins on its own node */
+    LOCK_TYPE_COUNT
+};
+
+/**
+ * Number of power of two buckets in a struct lock_histogram.  Bucket i counts
+ * durations d with 2^(i-1) <= d < 2^i nanoseconds, bucket 0 counts d == 0 and
+ * the last bucket collects everything above.
+ */
+#define LOCK_HISTOGRAM_BUCKETS 40
+
+/**
+ * Number of attempts a LOCK_TYPE_SPIN_THEN_PARK lock spins before parking
+ */
+#define LOCK_DEFAULT_SPIN_LIMIT 100
+
+/**
+ * Maximum number of MCS locks a single thread may hold at the same time
+ */
+#define LOCK_MCS_MAX_NESTING 8
+
+struct lock_histogram
+{
+    _Atomic uint64_t bucket[LOCK_HISTOGRAM_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t total_ns;
+    _Atomic uint64_t max_ns;
+};
+
+struct mcs_node
+{
+    struct mcs_node *_Atomic next;
+    atomic_bool locked;
+};
+
+struct profiled_lock
+{
+    enum lock_type type;
+    /**
+     * Name printed by profiled_lock_report(), may be NULL
+     */
+    const char *name;
+    union
+    {
+        pthread_mutex_t mutex;
+        struct
+        {
+            /* 0 unlocked, 1 locked, 2 locked with sleeping waiters */
+            atomic_int state;
+            int spin_limit;
+        } spin_park;
+        struct
+        {
+            atomic_uint next;
+            atomic_uint serving;
+        } ticket;
+        struct
+        {
+            struct mcs_node *_Atomic tail;
+            /* node of the current holder, only touched by the holder */
+            struct mcs_node *owner;
+        } mcs;
+    } u;
+    /**
+     * Timestamp of the last successful acquire, only touched by the holder
+     */
+    uint64_t acquired_at_ns;
+    /**
+     * Time between the call to profiled_lock_acquire() and obtaining the lock
+     */
+    struct lock_histogram wait_hist;
+    /**
+     * Time between obtaining the lock and the call to profiled_lock_release()
+     */
+    struct lock_histogram hold_hist;
+};
+
+/**
+ * @param lock the lock to initialize
+ * @param type the locking primitive to use
+ * @param name optional name used in reports, must outlive @param lock
+ * @return 0 on success or an errno value
+ */
+int profiled_lock_init(struct profiled_lock *lock, enum lock_type type, const char *name);
+
+/**
+ * @return 0 on success or an errno value.  The lock must not be held.
+ */
+int profiled_lock_destroy(struct profiled_lock *lock);
+
+/**
+ * Block until @param lock is obtained and record the time spent waiting.
+ * @return 0 on success or an errno value
+ */
+int profiled_lock_acquire(struct profiled_lock *lock);
+
+/**
+ * Release @param lock, which must be held by the calling thread, and record the hold time.
+ * MCS locks must be released in the reverse order they were acquired.
+ * @return 0 on success or an errno value
+ */
+int profiled_lock_release(struct profiled_lock *lock);
+
+/**
+ * Clear the wait and hold histograms of @param lock.  Should not be called
+ * while other threads use the lock if exact numbers are required.
+ */
+void profiled_lock_reset_stats(struct profiled_lock *lock);
+
+/**
+ * @return an upper bound in nanoseconds for the @param percentile (0-100) of
+ * the durations recorded in @param hist, 0 if nothing was recorded
+ */
+uint64_t lock_histogram_percentile(const struct lock_histogram *hist, double percentile);
+
+/**
+ * Print the count, mean, percentiles and the non empty buckets of both
+ * histograms of @param lock to @param out
+ */
+void profiled_lock_report(const struct profiled_lock *lock, FILE *out);
+
+/**
+ * @return a short name for @param type such as "mutex" or "mcs"
+ */
+const char *lock_type_name(enum lock_type type);
+
+/**
+ * Look up the lock type for a name returned by lock_type_name()
+ * @return true and fill @param type if @param name is known
+ */
+bool lock_type_from_name(const char *name, enum lock_type *type);
+
+/**
+ * @return the CLOCK_MONOTONIC time in nanoseconds
+ */
+uint64_t lock_profiler_now_ns(void);
+
+#endif /* LOCK_PROFILER_H */
@@ -0,0 +1,158 @@
+#include "profiled-thread.h"
+#include "async-log.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+// Messages are queued and written by the async-log thread, so logging does not
+// change the timing of the threads under test.  Build with -DASYNC_LOG_LEVEL=LOG_ERR
+// to compile the debug messages out.
+#define DEBUG_LOG(msg,...) ASYNC_LOG(LOG_DEBUG, "threading: " msg "\n" , ##__VA_ARGS__)
+#define ERROR_LOG(msg,...) ASYNC_LOG(LOG_ERR, "threading ERROR: " msg "\n" , ##__VA_ARGS__)
+
+static int obtain(struct profiled_thread_data *args)
+{
+    if(args->lock != NULL)
+    {
+        return profiled_lock_acquire(args->lock);
+    }
+    return pthread_mutex_lock(args->data.mutex);
+}
+
+static int release(struct profiled_thread_data *args)
+{
+    if(args->lock != NULL)
+    {
+        return profiled_lock_release(args->lock);
+    }
+    return pthread_mutex_unlock(args->data.mutex);
+}
+
+/**
+ * threadfunc() from threading.c for a struct profiled_thread_data
+ */
+static void* profiled_threadfunc(void* thread_param)
+{
+    struct profiled_thread_data* thread_func_args = (struct profiled_thread_data *) thread_param;
+    int rc;
+
+    rc = thread_attr_apply_self(&thread_func_args->attr);
+    if(rc != 0)
+    {
+        /* the preferred node is only a hint, run without it */
+        ERROR_LOG("Failed to prefer NUMA node %d: %s", thread_func_args->attr.numa_node, strerror(rc));
+    }
+    rc = thread_attr_get_self(&thread_func_args->placed);
+    if(rc != 0)
+    {
+        ERROR_LOG("Failed to read back the thread placement: %s", strerror(rc));
+        thread_func_args->data.thread_complete_success = false;
+        return thread_param;
+    }
+
+    DEBUG_LOG("Waiting for %d ms before locking mutex", thread_func_args->data.wait_to_obtain_ms);
+    if(usleep(thread_func_args->data.wait_to_obtain_ms * 1000) != 0)
+    {
+        thread_func_args->data.thread_complete_success = false;
+        return thread_param;
+    }
+
+    if(obtain(thread_func_args) != 0)
+    {
+        thread_func_args->data.thread_complete_success = false;
+        return thread_param;
+    }
+
+    DEBUG_LOG("Waiting for %d ms while locking mutex", thread_func_args->data.wait_to_release_ms);
+    if(usleep(thread_func_args->data.wait_to_release_ms * 1000) != 0)
+    {
+        thread_func_args->data.thread_complete_success = false;
+        release(thread_func_args);
+        return thread_param;
+    }
+
+    if(release(thread_func_args) != 0)
+    {
+        thread_func_args->data.thread_complete_success = false;
+        return thread_param;
+    }
+
+    thread_func_args->data.thread_complete_success = true;
+    return thread_param;
+}
+
+/**
+ * Start profiled_threadfunc() obtaining either @param mutex or @param lock,
+ * with the placement in @param attr if not NULL
+ */
+static bool start_thread(pthread_t *thread, pthread_mutex_t *mutex, struct profiled_lock *lock,
+        int wait_to_obtain_ms, int wait_to_release_ms, const struct thread_attr *attr)
+{
+    struct profiled_thread_data *thread_data = malloc(sizeof(struct profiled_thread_data));
+    pthread_attr_t pattr;
+    int rc;
+
+    if(thread_data == NULL)
+    {
+        ERROR_LOG("Failed to allocate memory for thread_data");
+        return false;
+    }
+
+    thread_data->data.mutex = mutex;
+    thread_data->data.wait_to_obtain_ms = wait_to_obtain_ms;
+    thread_data->data.wait_to_release_ms = wait_to_release_ms;
+    thread_data->lock = lock;
+    if(attr != NULL)
+    {
+        thread_data->attr = *attr;
+    }
+    else
+    {
+        thread_attr_init(&thread_data->attr);
+    }
+
+    if(attr == NULL)
+    {
+        rc = pthread_create(thread, NULL, profiled_threadfunc, thread_data);
+    }
+    else
+    {
+        rc = pthread_attr_init(&pattr);
+        if(rc == 0)
+        {
+            rc = thread_attr_to_pthread(attr, &pattr);
+            if(rc == 0)
+            {
+                rc = pthread_create(thread, &pattr, profiled_threadfunc, thread_data);
+            }
+            pthread_attr_destroy(&pattr);
+        }
+    }
+
+    if(rc != 0)
+    {
+        ERROR_LOG("Failed to create thread: %s", strerror(rc));
+        free(thread_data);
+        return false;
+    }
+
+    return true;
+}
+
+bool start_thread_obtaining_lock(pthread_t *thread, struct profiled_lock *lock,int wait_to_obtain_ms, int wait_to_release_ms)
+{
+    return start_thread(thread, NULL, lock, wait_to_obtain_ms, wait_to_release_ms, NULL);
+}
+
+bool start_thread_obtaining_mutex_attr(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms,
+        const struct thread_attr *attr)
+{
+    return start_thread(thread, mutex, NULL, wait_to_obtain_ms, wait_to_release_ms, attr);
+}
+
+bool start_thread_obtaining_lock_attr(pthread_t *thread, struct profiled_lock *lock,int wait_to_obtain_ms, int wait_to_release_ms,
+        const struct thread_attr *attr)
+{
+    return start_thread(thread, NULL, lock, wait_to_obtain_ms, wait_to_release_ms, attr);
+}
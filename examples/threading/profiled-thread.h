@@ -0,0 +1,66 @@
+/*
+ * profiled-thread.h
+ *
+ * Variants of start_thread_obtaining_mutex() from threading.h whose threads
+ * obtain a profiled lock from lock-profiler.h instead of a mutex, or are
+ * started with the placement in a struct thread_attr from thread-attr.h.
+ * They live in their own translation unit so threading.c builds and links
+ * on its own, as the assignment's unit tests expect.
+ */
+
+#ifndef PROFILED_THREAD_H
+#define PROFILED_THREAD_H
+
+#include "thread-attr.h"
+#include "threading.h"
+#include "lock-profiler.h"
+
+/**
+ * Thread data of the variants below.  data comes first, so the pointer a
+ * thread returns is also a struct thread_data * the joiner can check and free.
+ */
+struct profiled_thread_data
+{
+    struct thread_data data;
+    /**
+     * When set, the thread obtains this instrumented lock instead of data.mutex
+     */
+    struct profiled_lock *lock;
+    /**
+     * CPU set, scheduling and NUMA placement the thread was started with.
+     * Defaults from thread_attr_init() when none were given.
+     */
+    struct thread_attr attr;
+    /**
+     * Placement the thread found itself running with once it applied attr,
+     * read back with thread_attr_get_self()
+     */
+    struct thread_attr placed;
+};
+
+/**
+* Same as start_thread_obtaining_mutex() but the thread obtains the instrumented lock in @param lock,
+* which records the time spent waiting for and holding it.  See lock-profiler.h
+* @return true if the thread could be started, false if a failure occurred.
+*/
+bool start_thread_obtaining_lock(pthread_t *thread, struct profiled_lock *lock,int wait_to_obtain_ms, int wait_to_release_ms);
+
+/**
+* Same as start_thread_obtaining_mutex() but the thread is created with the CPU set, scheduling
+* policy and priority, stack size and NUMA node in @param attr, which may be NULL for the defaults.
+* @param attr is copied, it does not need to outlive the call.
+* @return true if the thread could be started, false if a failure occurred, for instance when the
+* caller lacks the privileges for a real time scheduling policy.
+*/
+bool start_thread_obtaining_mutex_attr(pthread_t *thread, pthread_mutex_t *mutex,int wait_to_obtain_ms, int wait_to_release_ms,
+        const struct thread_attr *attr);
+
+/**
+* Same as start_thread_obtaining_lock() with the placement in @param attr, see
+* start_thread_obtaining_mutex_attr()
+* @return true if the thread could be started, false if a failure occurred.
+*/
+bool start_thread_obtaining_lock_attr(pthread_t *thread, struct profiled_lock *lock,int wait_to_obtain_ms, int wait_to_release_ms,
+        const struct thread_attr *attr);
+
+#endif /* PROFILED_THREAD_H */
@@ -0,0 +1,479 @@
+/*
+ * thread-attr.c
+ *
+ * See thread-attr.h
+ */
+
+#include "thread-attr.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/* from linux/mempolicy.h, which is not always installed */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_F_NODE
+#define MPOL_F_NODE (1 << 0)
+#endif
+#ifndef MPOL_F_ADDR
+#define MPOL_F_ADDR (1 << 1)
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+
+#define NODE_MASK_LONGS (THREAD_ATTR_MAX_NODES / (8 * sizeof(unsigned long)))
+
+#define SYSFS_CPU  "/sys/devices/system/cpu"
+#define SYSFS_NODE "/sys/devices/system/node"
+
+void thread_attr_init(struct thread_attr *attr)
+{
+    memset(attr, 0, sizeof(*attr));
+    CPU_ZERO(&attr->cpus);
+    attr->policy = SCHED_OTHER;
+    attr->numa_node = -1;
+}
+
+void thread_attr_add_cpu(struct thread_attr *attr, int cpu)
+{
+    CPU_SET(cpu, &attr->cpus);
+    attr->use_cpus = true;
+}
+
+int thread_attr_set_sched(struct thread_attr *attr, int policy, int priority)
+{
+    if(policy != SCHED_OTHER && policy != SCHED_FIFO && policy != SCHED_RR)
+    {
+        return EINVAL;
+    }
+    if(priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy))
+    {
+        return EINVAL;
+    }
+    attr->policy = policy;
+    attr->priority = priority;
+    return 0;
+}
+
+bool thread_attr_parse_sched(struct thread_attr *attr, const char *spec)
+{
+    const char *colon = strchr(spec, ':');
+    size_t name_len = colon != NULL ? (size_t)(colon - spec) : strlen(spec);
+    int priority = 0;
+    int policy;
+
+    if(name_len == 5 && strncmp(spec, "other", 5) == 0)
+    {
+        policy = SCHED_OTHER;
+    }
+    else if(name_len == 4 && strncmp(spec, "fifo", 4) == 0)
+    {
+        policy = SCHED_FIFO;
+    }
+    else if(name_len == 2 && strncmp(spec, "rr", 2) == 0)
+    {
+        policy = SCHED_RR;
+    }
+    else
+    {
+        return false;
+    }
+
+    if(colon != NULL)
+    {
+        char *end;
+        long value = strtol(colon + 1, &end, 10);
+        if(end == colon + 1 || *end != '\0' || value < 0 || value > INT_MAX)
+        {
+            return false;
+        }
+        priority = (int)value;
+    }
+    else if(policy != SCHED_OTHER)
+    {
+        priority = sched_get_priority_min(policy);
+    }
+    return thread_attr_set_sched(attr, policy, priority) == 0;
+}
+
+/**
+ * Parse a sysfs CPU or node list such as "0-3,8,10-11" into @param set
+ * @return 0 on success or an errno value
+ */
+static int read_cpulist(const char *path, cpu_set_t *set)
+{
+    char buf[4096];
+    FILE *file = fopen(path, "r");
+    char *p;
+
+    CPU_ZERO(set);
+    if(file == NULL)
+    {
+        return errno;
+    }
+    if(fgets(buf, sizeof(buf), file) == NULL)
+    {
+        fclose(file);
+        return EIO;
+    }
+    fclose(file);
+
+    p = buf;
+    while(*p != '\0' && *p != '\n')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        long i;
+
+        if(end == p)
+        {
+            return EINVAL;
+        }
+        p = end;
+        if(*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for(i = first; i <= last && i < CPU_SETSIZE; i++)
+        {
+            CPU_SET((int)i, set);
+        }
+        if(*p == ',')
+        {
+            p++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return the integer in sysfs file @param path, or @param fallback if it cannot be read
+ */
+static int read_sysfs_int(const char *path, int fallback)
+{
+    FILE *file = fopen(path, "r");
+    int value;
+
+    if(file == NULL)
+    {
+        return fallback;
+    }
+    if(fscanf(file, "%d", &value) != 1)
+    {
+        value = fallback;
+    }
+    fclose(file);
+    return value;
+}
+
+int numa_node_count(void)
+{
+    cpu_set_t nodes;
+    int count = 1;
+    int node;
+
+    if(read_cpulist(SYSFS_NODE "/has_cpu", &nodes) != 0)
+    {
+        return 1;
+    }
+    for(node = 0; node < THREAD_ATTR_MAX_NODES; node++)
+    {
+        if(CPU_ISSET(node, &nodes))
+        {
+            count = node + 1;
+        }
+    }
+    return count;
+}
+
+int numa_node_cpus(int node, cpu_set_t *cpus)
+{
+    char path[64];
+    int rc;
+
+    if(node < 0 || node >= THREAD_ATTR_MAX_NODES)
+    {
+        return EINVAL;
+    }
+    snprintf(path, sizeof(path), SYSFS_NODE "/node%d/cpulist", node);
+    rc = read_cpulist(path, cpus);
+    if(rc == ENOENT && node == 0)
+    {
+        /* kernel built without NUMA, everything is on node 0 */
+        rc = read_cpulist(SYSFS_CPU "/online", cpus);
+    }
+    return rc;
+}
+
+int numa_node_of_cpu(int cpu)
+{
+    cpu_set_t cpus;
+    int nodes = numa_node_count();
+    int node;
+
+    for(node = 0; node < nodes; node++)
+    {
+        if(numa_node_cpus(node, &cpus) == 0 && CPU_ISSET(cpu, &cpus))
+        {
+            return node;
+        }
+    }
+    return 0;
+}
+
+int numa_node_of_address(const void *addr)
+{
+    int node = -1;
+
+    if(syscall(SYS_get_mempolicy, &node, NULL, 0UL, addr, MPOL_F_NODE | MPOL_F_ADDR) != 0)
+    {
+        return -1;
+    }
+    return node;
+}
+
+int numa_bind_memory(void *addr, size_t len, int node)
+{
+    unsigned long mask[NODE_MASK_LONGS];
+
+    if(node < 0 || node >= THREAD_ATTR_MAX_NODES)
+    {
+        return EINVAL;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    if(syscall(SYS_mbind, addr, len, MPOL_BIND, mask, THREAD_ATTR_MAX_NODES + 1UL, MPOL_MF_MOVE) != 0)
+    {
+        return errno;
+    }
+    return 0;
+}
+
+int thread_attr_to_pthread(const struct thread_attr *attr, pthread_attr_t *pattr)
+{
+    struct sched_param param;
+    int rc;
+
+    if(attr->use_cpus)
+    {
+        rc = pthread_attr_setaffinity_np(pattr, sizeof(attr->cpus), &attr->cpus);
+        if(rc != 0)
+        {
+            return rc;
+        }
+    }
+    else if(attr->numa_node >= 0)
+    {
+        cpu_set_t cpus;
+
+        rc = numa_node_cpus(attr->numa_node, &cpus);
+        if(rc == 0)
+        {
+            rc = pthread_attr_setaffinity_np(pattr, sizeof(cpus), &cpus);
+        }
+        if(rc != 0)
+        {
+            return rc;
+        }
+    }
+
+    rc = pthread_attr_setinheritsched(pattr, PTHREAD_EXPLICIT_SCHED);
+    if(rc == 0)
+    {
+        rc = pthread_attr_setschedpolicy(pattr, attr->policy);
+    }
+    if(rc == 0)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = attr->priority;
+        rc = pthread_attr_setschedparam(pattr, &param);
+    }
+    if(rc == 0 && attr->stack_size != 0)
+    {
+        rc = pthread_attr_setstacksize(pattr, attr->stack_size);
+    }
+    return rc;
+}
+
+int thread_attr_apply_self(const struct thread_attr *attr)
+{
+    unsigned long mask[NODE_MASK_LONGS];
+    int node = attr->numa_node;
+
+    if(node < 0)
+    {
+        return 0;
+    }
+    if(node >= THREAD_ATTR_MAX_NODES)
+    {
+        return EINVAL;
+    }
+    /*
+     * The stack was mapped by the creating thread but its pages are only
+     * faulted in from here on, so they follow this policy too
+     */
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+    if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, THREAD_ATTR_MAX_NODES + 1UL) != 0)
+    {
+        return errno;
+    }
+    return 0;
+}
+
+int thread_attr_get_self(struct thread_attr *attr)
+{
+    unsigned long mask[NODE_MASK_LONGS];
+    struct sched_param param;
+    pthread_attr_t pattr;
+    int mode = 0;
+    int node;
+    int rc;
+
+    thread_attr_init(attr);
+    if(sched_getaffinity(0, sizeof(attr->cpus), &attr->cpus) != 0)
+    {
+        return errno;
+    }
+    attr->use_cpus = true;
+    attr->policy = sched_getscheduler(0);
+    if(attr->policy < 0 || sched_getparam(0, &param) != 0)
+    {
+        return errno;
+    }
+    attr->policy &= ~SCHED_RESET_ON_FORK;
+    attr->priority = param.sched_priority;
+
+    rc = pthread_getattr_np(pthread_self(), &pattr);
+    if(rc != 0)
+    {
+        return rc;
+    }
+    rc = pthread_attr_getstacksize(&pattr, &attr->stack_size);
+    pthread_attr_destroy(&pattr);
+    if(rc != 0)
+    {
+        return rc;
+    }
+
+    /* the mode flags are or'ed into the upper bits of mode */
+    memset(mask, 0, sizeof(mask));
+    if(syscall(SYS_get_mempolicy, &mode, mask, THREAD_ATTR_MAX_NODES + 1UL, NULL, 0UL) == 0
+            && (mode & 0xff) == MPOL_PREFERRED)
+    {
+        for(node = 0; node < THREAD_ATTR_MAX_NODES; node++)
+        {
+            if(mask[node / (8 * sizeof(unsigned long))] & (1UL << (node % (8 * sizeof(unsigned long)))))
+            {
+                attr->numa_node = node;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+struct cpu_topology
+{
+    int cpu;
+    int package;
+    int core;
+    /* position of cpu among the hyperthreads of its core */
+    int smt_rank;
+};
+
+static int compare_compact(const void *a, const void *b)
+{
+    const struct cpu_topology *x = a;
+    const struct cpu_topology *y = b;
+
+    if(x->package != y->package)
+    {
+        return x->package < y->package ? -1 : 1;
+    }
+    if(x->core != y->core)
+    {
+        return x->core < y->core ? -1 : 1;
+    }
+    return x->smt_rank - y->smt_rank;
+}
+
+static int compare_spread(const void *a, const void *b)
+{
+    const struct cpu_topology *x = a;
+    const struct cpu_topology *y = b;
+
+    if(x->smt_rank != y->smt_rank)
+    {
+        return x->smt_rank - y->smt_rank;
+    }
+    if(x->core != y->core)
+    {
+        return x->core < y->core ? -1 : 1;
+    }
+    return x->package - y->package;
+}
+
+int thread_attr_cpu_order(enum cpu_placement placement, int *cpus, int max)
+{
+    struct cpu_topology *topo;
+    cpu_set_t online;
+    char path[96];
+    int count = 0;
+    int cpu;
+    int i;
+    int j;
+
+    if(read_cpulist(SYSFS_CPU "/online", &online) != 0
+            && sched_getaffinity(0, sizeof(online), &online) != 0)
+    {
+        return 0;
+    }
+    topo = calloc(CPU_COUNT(&online), sizeof(*topo));
+    if(topo == NULL)
+    {
+        return 0;
+    }
+
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, &online))
+        {
+            continue;
+        }
+        topo[count].cpu = cpu;
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+        topo[count].package = read_sysfs_int(path, 0);
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+        topo[count].core = read_sysfs_int(path, cpu);
+        for(j = 0; j < count; j++)
+        {
+            if(topo[j].package == topo[count].package && topo[j].core == topo[count].core)
+            {
+                topo[count].smt_rank++;
+            }
+        }
+        count++;
+    }
+
+    qsort(topo, count, sizeof(*topo),
+            placement == CPU_PLACEMENT_SPREAD ? compare_spread : compare_compact);
+    for(i = 0; i < count && i < max; i++)
+    {
+        cpus[i] = topo[i].cpu;
+    }
+    free(topo);
+    return i;
+}
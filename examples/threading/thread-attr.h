@@ -0,0 +1,147 @@
+/*
+ * thread-attr.h
+ *
+ * Placement and scheduling attributes for the threads started by
+ * profiled-thread.c and lock-bench.  A struct thread_attr collects the CPU set,
+ * scheduling policy, stack size and NUMA node of a thread, and turns them
+ * into a pthread_attr_t plus a memory policy the thread applies to itself
+ * once it runs.  NUMA support uses sysfs and the raw mempolicy system calls,
+ * so libnuma is not needed; on machines without NUMA every CPU is on node 0.
+ */
+
+#ifndef THREAD_ATTR_H
+#define THREAD_ATTR_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+
+/**
+ * NUMA nodes 0 to THREAD_ATTR_MAX_NODES - 1 are supported by the helpers below
+ */
+#define THREAD_ATTR_MAX_NODES 64
+
+struct thread_attr
+{
+    /**
+     * CPUs the thread may run on, ignored while use_cpus is false
+     */
+    cpu_set_t cpus;
+    bool use_cpus;
+    /**
+     * SCHED_OTHER, SCHED_FIFO or SCHED_RR.  The real time policies usually
+     * need CAP_SYS_NICE or an RLIMIT_RTPRIO large enough for priority.
+     */
+    int policy;
+    int priority;
+    /**
+     * Stack size in bytes, 0 for the default
+     */
+    size_t stack_size;
+    /**
+     * NUMA node the thread allocates memory from, -1 for no preference.
+     * Without an explicit CPU set the thread also runs on the CPUs of this node.
+     */
+    int numa_node;
+};
+
+/**
+ * Initialize @param attr to the defaults used by pthread_create() with NULL attributes
+ */
+void thread_attr_init(struct thread_attr *attr);
+
+/**
+ * Add @param cpu to the CPU set of @param attr
+ */
+void thread_attr_add_cpu(struct thread_attr *attr, int cpu);
+
+/**
+ * @param policy SCHED_OTHER, SCHED_FIFO or SCHED_RR
+ * @param priority static priority, must be 0 for SCHED_OTHER
+ * @return 0 or EINVAL if @param priority is out of range for @param policy
+ */
+int thread_attr_set_sched(struct thread_attr *attr, int policy, int priority);
+
+/**
+ * Fill @param pattr, which must already be initialized with pthread_attr_init(),
+ * from @param attr.  The scheduling policy is set explicitly rather than
+ * inherited from the creating thread.
+ * @return 0 on success or an errno value
+ */
+int thread_attr_to_pthread(const struct thread_attr *attr, pthread_attr_t *pattr);
+
+/**
+ * Apply the parts of @param attr that can only be set from the thread itself,
+ * currently the preferred NUMA node for its memory.  Call first thing in the
+ * thread function.
+ * @return 0 on success or an errno value
+ */
+int thread_attr_apply_self(const struct thread_attr *attr);
+
+/**
+ * Fill @param attr with the placement the calling thread actually runs with:
+ * its CPU set, scheduling policy and priority, stack size and preferred NUMA
+ * node, -1 unless its memory policy prefers a single node
+ * @return 0 on success or an errno value
+ */
+int thread_attr_get_self(struct thread_attr *attr);
+
+/**
+ * Parse a scheduling specification such as "other", "fifo:10" or "rr:5"
+ * @return true and fill the policy of @param attr if @param spec is valid
+ */
+bool thread_attr_parse_sched(struct thread_attr *attr, const char *spec);
+
+/**
+ * @return one more than the highest numbered NUMA node with CPUs, at least 1
+ */
+int numa_node_count(void);
+
+/**
+ * Fill @param cpus with the CPUs of NUMA @param node
+ * @return 0 on success or an errno value
+ */
+int numa_node_cpus(int node, cpu_set_t *cpus);
+
+/**
+ * @return the NUMA node @param cpu belongs to, 0 if unknown
+ */
+int numa_node_of_cpu(int cpu);
+
+/**
+ * @return the NUMA node of the page holding @param addr, which must have been
+ * touched already, or -1 if the kernel does not support the query
+ */
+int numa_node_of_address(const void *addr);
+
+/**
+ * Bind the @param len bytes at @param addr, which must be page aligned, to
+ * NUMA @param node and move pages already touched there
+ * @return 0 on success or an errno value
+ */
+int numa_bind_memory(void *addr, size_t len, int node);
+
+/**
+ * Order in which thread_attr_cpu_order() lists the online CPUs
+ */
+enum cpu_placement
+{
+    /* threads share sockets and cores as far as possible, hyperthread siblings are adjacent */
+    CPU_PLACEMENT_COMPACT,
+    /* consecutive CPUs are on different sockets, then different cores, siblings come last */
+    CPU_PLACEMENT_SPREAD,
+};
+
+/**
+ * List up to @param max online CPUs in @param cpus, ordered by @param placement
+ * according to the package and core ids in sysfs
+ * @return the number of CPUs listed
+ */
+int thread_attr_cpu_order(enum cpu_placement placement, int *cpus, int max);
+
+#endif /* THREAD_ATTR_H */
@@ -0,0 +1,166 @@
+/**
+ * @file threading-test.c
+ * @brief Starts threads through every start_thread_obtaining_* entry point
+ *
+ * Each check starts a few threads which all obtain the same mutex or
+ * profiled lock, joins them and checks the struct thread_data they return.
+ * For the profiled locks the wait and hold histograms must have recorded
+ * every thread.  The placement checks pin a thread to one CPU with a
+ * scheduling policy, stack size and NUMA node and compare that to the
+ * placement the thread read back once it was running.
+ */
+
+#include "profiled-thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_THREADS 4
+#define TEST_WAIT_TO_OBTAIN_MS 20
+#define TEST_WAIT_TO_RELEASE_MS 5
+#define TEST_STACK_SIZE (256 * 1024)
+
+/**
+ * Like CHECK() but not compiled out by -DNDEBUG, most checks call the code under test
+ */
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while(0)
+
+/**
+ * Join @param count threads in @param threads, each must have succeeded
+ */
+static void join_all(pthread_t *threads, int count)
+{
+    int i;
+
+    for(i = 0; i < count; i++)
+    {
+        struct thread_data *data = NULL;
+
+        CHECK(pthread_join(threads[i], (void **)&data) == 0);
+        CHECK(data != NULL && data->thread_complete_success);
+        free(data);
+    }
+}
+
+static void check_mutex(bool with_attr)
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t threads[TEST_THREADS];
+    struct thread_attr attr;
+    int i;
+
+    thread_attr_init(&attr);
+    for(i = 0; i < TEST_THREADS; i++)
+    {
+        if(with_attr)
+        {
+            CHECK(start_thread_obtaining_mutex_attr(&threads[i], &mutex, TEST_WAIT_TO_OBTAIN_MS,
+                    TEST_WAIT_TO_RELEASE_MS, &attr));
+        }
+        else
+        {
+            CHECK(start_thread_obtaining_mutex(&threads[i], &mutex, TEST_WAIT_TO_OBTAIN_MS,
+                    TEST_WAIT_TO_RELEASE_MS));
+        }
+    }
+    join_all(threads, TEST_THREADS);
+    pthread_mutex_destroy(&mutex);
+    printf("test successful -> %s\n", with_attr ? "start_thread_obtaining_mutex_attr" : "start_thread_obtaining_mutex");
+}
+
+static void check_lock(enum lock_type type, bool with_attr)
+{
+    struct profiled_lock lock;
+    pthread_t threads[TEST_THREADS];
+    struct thread_attr attr;
+    int i;
+
+    CHECK(profiled_lock_init(&lock, type, lock_type_name(type)) == 0);
+    thread_attr_init(&attr);
+    for(i = 0; i < TEST_THREADS; i++)
+    {
+        if(with_attr)
+        {
+            CHECK(start_thread_obtaining_lock_attr(&threads[i], &lock, TEST_WAIT_TO_OBTAIN_MS,
+                    TEST_WAIT_TO_RELEASE_MS, &attr));
+        }
+        else
+        {
+            CHECK(start_thread_obtaining_lock(&threads[i], &lock, TEST_WAIT_TO_OBTAIN_MS,
+                    TEST_WAIT_TO_RELEASE_MS));
+        }
+    }
+    join_all(threads, TEST_THREADS);
+    CHECK(lock.wait_hist.count == TEST_THREADS);
+    CHECK(lock.hold_hist.count == TEST_THREADS);
+    // every thread held the lock for at least its wait_to_release_ms
+    CHECK(lock.hold_hist.total_ns >= TEST_THREADS * TEST_WAIT_TO_RELEASE_MS * 1000000ull);
+    CHECK(profiled_lock_destroy(&lock) == 0);
+    printf("test successful -> %s with %s\n", with_attr ? "start_thread_obtaining_lock_attr"
+            : "start_thread_obtaining_lock", lock_type_name(type));
+}
+
+static void check_placement(int policy, int priority)
+{
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct profiled_thread_data *data = NULL;
+    struct thread_attr attr;
+    cpu_set_t allowed;
+    pthread_t thread;
+    int cpu;
+
+    // the highest CPU the process may use, which is not the only one a thread gets by default on SMP
+    CHECK(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+    for(cpu = CPU_SETSIZE - 1; !CPU_ISSET(cpu, &allowed); cpu--)
+    {
+    }
+    thread_attr_init(&attr);
+    thread_attr_add_cpu(&attr, cpu);
+    CHECK(thread_attr_set_sched(&attr, policy, priority) == 0);
+    attr.stack_size = TEST_STACK_SIZE;
+    attr.numa_node = numa_node_of_cpu(cpu);
+
+    if(!start_thread_obtaining_mutex_attr(&thread, &mutex, 0, 0, &attr))
+    {
+        // real time policies need CAP_SYS_NICE or RLIMIT_RTPRIO
+        CHECK(policy != SCHED_OTHER);
+        printf("test skipped -> placement with policy %d, not permitted\n", policy);
+        return;
+    }
+    CHECK(pthread_join(thread, (void **)&data) == 0);
+    CHECK(data != NULL && data->data.thread_complete_success);
+    CHECK(CPU_COUNT(&data->placed.cpus) == 1 && CPU_ISSET(cpu, &data->placed.cpus));
+    CHECK(data->placed.policy == policy && data->placed.priority == priority);
+    CHECK(data->placed.stack_size >= TEST_STACK_SIZE);
+    // kernels without NUMA support neither set nor report a preferred node
+    if(numa_node_of_address(&allowed) >= 0)
+    {
+        CHECK(data->placed.numa_node == attr.numa_node);
+    }
+    free(data);
+    pthread_mutex_destroy(&mutex);
+    printf("test successful -> placement on cpu %d node %d with policy %d priority %d\n", cpu, attr.numa_node,
+            policy, priority);
+}
+
+int main(int argc, char **argv)
+{
+    int type;
+
+    check_mutex(false);
+    check_mutex(true);
+    for(type = 0; type < LOCK_TYPE_COUNT; type++)
+    {
+        check_lock((enum lock_type)type, false);
+        check_lock((enum lock_type)type, true);
+    }
+    check_placement(SCHED_OTHER, 0);
+    check_placement(SCHED_FIFO, 1);
+    check_placement(SCHED_RR, 1);
+    return 0;
+}
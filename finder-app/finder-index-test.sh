@@ -0,0 +1,51 @@
+#!/bin/sh
+# Checks that finder -i skips files whose bloom filter rules out the search
+# string.  A file with a few hundred KB of distinct text is indexed, then its
+# contents are replaced with lines containing the search string while keeping
+# its inode, size and mtime.  finder only counts those lines if it reads the
+# file again, so the file is known to be skipped when they are not counted.
+
+cd `dirname $0`
+make finder > /dev/null || exit 1
+
+rc=0
+dir=$(mktemp -d /tmp/finder-index.XXXXXX)
+index=${dir}.idx
+needle=needle_not_in_base64
+
+check()
+{
+	expected="The number of files are $2 and the number of matching lines are $3"
+	result=$(./finder -i ${index} ${dir} "$1")
+	if [ "${result}" != "${expected}" ]; then
+		echo "search for $1: expected '${expected}', got '${result}'"
+		rc=1
+	fi
+}
+
+# random base64 text holds most of the 64^3 possible trigrams, '_' is not among them
+head -c 300000 /dev/urandom | base64 > ${dir}/large.txt
+printf 'one %s line\nanother line\n' ${needle} > ${dir}/small.txt
+# the index rescans files modified during the run that saved it
+touch -d '2020-01-01 00:00:00' ${dir}/large.txt ${dir}/small.txt
+
+check "another line" 2 1
+size=$(wc -c < ${dir}/large.txt)
+# same inode, size and mtime, but now every line matches
+yes ${needle} | head -c ${size} | dd of=${dir}/large.txt conv=notrunc 2> /dev/null
+touch -d '2020-01-01 00:00:00' ${dir}/large.txt
+check ${needle} 2 1
+
+# a changed mtime makes finder read the file again
+touch ${dir}/large.txt
+check ${needle} 2 $((1 + $(grep -c ${needle} ${dir}/large.txt)))
+
+# an entry count the index file cannot hold means a full scan, not a failed allocation
+printf '\377\377\377\377\377\377\377\177' | dd of=${index} bs=1 seek=24 conv=notrunc 2> /dev/null
+check ${needle} 2 $((1 + $(grep -c ${needle} ${dir}/large.txt)))
+
+rm -rf ${dir} ${index}
+if [ ${rc} -eq 0 ]; then
+	echo "finder index tests passed"
+fi
+exit ${rc}
@@ -0,0 +1,440 @@
+/**
+ * @file finder-index.c
+ * @brief Load, query and save the finder on-disk index
+ *
+ * The index file starts with a struct index_header followed by one
+ * struct index_record, the relative path and the bloom filter for every
+ * file.  All values
+ * are stored in host byte order, an index is only meaningful on the
+ * machine which wrote it.
+ */
+
+#include "finder-index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "FNDRIDX2"
+#define INDEX_MAX_PATH 4096
+
+struct index_header
+{
+    char magic[8];
+    uint32_t bloom_hashes;
+    uint32_t reserved;
+    uint64_t query_hash;
+    uint64_t count;
+};
+
+struct index_record
+{
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t matches;
+    uint32_t path_len;
+    uint32_t bloom_bits;
+    uint32_t reserved;
+};
+
+uint64_t finder_index_hash(const char *data, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+    size_t i;
+
+    for(i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/**
+ * @return a 64 bit hash of @param trigram, the two halves seed the double
+ * hashing which picks the FINDER_INDEX_BLOOM_HASHES bits of the trigram
+ */
+static inline uint64_t trigram_hash(uint32_t trigram)
+{
+    uint64_t hash = trigram;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+static inline bool bloom_bits_valid(uint32_t bits)
+{
+    return bits == 0 || (bits >= FINDER_INDEX_BLOOM_MIN_BITS && bits <= FINDER_INDEX_BLOOM_MAX_BITS
+            && (bits & (bits - 1)) == 0);
+}
+
+static void bloom_add(struct finder_index_entry *entry, uint32_t trigram)
+{
+    uint64_t hash = trigram_hash(trigram);
+    uint32_t h1 = (uint32_t)(hash >> 32);
+    uint32_t h2 = (uint32_t)hash | 1;
+    unsigned int shift = 32 - (unsigned int)__builtin_ctz(entry->bloom_bits);
+    int i;
+
+    for(i = 0; i < FINDER_INDEX_BLOOM_HASHES; i++)
+    {
+        uint32_t bit = (h1 + (uint32_t)i * h2) >> shift;
+        entry->bloom[bit / 8] |= (uint8_t)(1u << (bit % 8));
+    }
+}
+
+static bool bloom_contains(const struct finder_index_entry *entry, uint32_t trigram)
+{
+    uint64_t hash = trigram_hash(trigram);
+    uint32_t h1 = (uint32_t)(hash >> 32);
+    uint32_t h2 = (uint32_t)hash | 1;
+    unsigned int shift = 32 - (unsigned int)__builtin_ctz(entry->bloom_bits);
+    int i;
+
+    for(i = 0; i < FINDER_INDEX_BLOOM_HASHES; i++)
+    {
+        uint32_t bit = (h1 + (uint32_t)i * h2) >> shift;
+        if((entry->bloom[bit / 8] & (1u << (bit % 8))) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void table_insert(struct finder_index *index, size_t entry)
+{
+    size_t slot = finder_index_hash(index->entries[entry].path, strlen(index->entries[entry].path))
+        & (index->table_size - 1);
+
+    while(index->table[slot] != 0)
+    {
+        slot = (slot + 1) & (index->table_size - 1);
+    }
+    index->table[slot] = entry + 1;
+}
+
+bool finder_index_load(struct finder_index *index, const char *path)
+{
+    struct index_header header;
+    struct stat st;
+    FILE *file;
+    size_t i;
+
+    memset(index, 0, sizeof(*index));
+
+    file = fopen(path, "rb");
+    if(file == NULL)
+    {
+        return true;
+    }
+
+    // every entry takes at least a record, a larger count is corrupt and must not size the allocation
+    if(fstat(fileno(file), &st) != 0
+            || fread(&header, sizeof(header), 1, file) != 1
+            || memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) != 0
+            || header.bloom_hashes != FINDER_INDEX_BLOOM_HASHES
+            || header.count > (uint64_t)(st.st_size - sizeof(header)) / sizeof(struct index_record))
+    {
+        fprintf(stderr, "finder: ignoring invalid index %s\n", path);
+        fclose(file);
+        return true;
+    }
+
+    index->entries = calloc(header.count ? header.count : 1, sizeof(*index->entries));
+    if(index->entries == NULL)
+    {
+        fclose(file);
+        return false;
+    }
+
+    for(i = 0; i < header.count; i++)
+    {
+        struct finder_index_entry *entry = &index->entries[i];
+        struct index_record record;
+
+        if(fread(&record, sizeof(record), 1, file) != 1 || record.path_len > INDEX_MAX_PATH
+                || !bloom_bits_valid(record.bloom_bits))
+        {
+            break;
+        }
+        entry->path = malloc(record.path_len + 1);
+        entry->bloom = malloc(record.bloom_bits / 8 + 1);
+        if(entry->path == NULL || entry->bloom == NULL
+                || fread(entry->path, 1, record.path_len, file) != record.path_len
+                || fread(entry->bloom, 1, record.bloom_bits / 8, file) != record.bloom_bits / 8)
+        {
+            free(entry->path);
+            free(entry->bloom);
+            entry->path = NULL;
+            entry->bloom = NULL;
+            break;
+        }
+        entry->path[record.path_len] = '\0';
+        entry->ino = record.ino;
+        entry->mtime_sec = record.mtime_sec;
+        entry->mtime_nsec = record.mtime_nsec;
+        entry->size = record.size;
+        entry->matches = record.matches;
+        entry->bloom_bits = record.bloom_bits;
+    }
+    fclose(file);
+
+    if(i != header.count)
+    {
+        fprintf(stderr, "finder: index %s is truncated, using the first %zu entries\n", path, i);
+    }
+    index->count = i;
+    index->query_hash = header.query_hash;
+
+    for(index->table_size = 16; index->table_size < index->count * 2; index->table_size *= 2)
+    {
+    }
+    index->table = calloc(index->table_size, sizeof(*index->table));
+    if(index->table == NULL)
+    {
+        return false;
+    }
+    for(i = 0; i < index->count; i++)
+    {
+        table_insert(index, i);
+    }
+    return true;
+}
+
+void finder_index_free(struct finder_index *index)
+{
+    size_t i;
+
+    for(i = 0; i < index->count; i++)
+    {
+        free(index->entries[i].path);
+        free(index->entries[i].bloom);
+    }
+    free(index->entries);
+    free(index->table);
+    memset(index, 0, sizeof(*index));
+}
+
+struct finder_index_entry *finder_index_lookup(const struct finder_index *index, const char *path)
+{
+    size_t slot;
+
+    if(index->table_size == 0)
+    {
+        return NULL;
+    }
+    slot = finder_index_hash(path, strlen(path)) & (index->table_size - 1);
+    while(index->table[slot] != 0)
+    {
+        struct finder_index_entry *entry = &index->entries[index->table[slot] - 1];
+        if(strcmp(entry->path, path) == 0)
+        {
+            return entry;
+        }
+        slot = (slot + 1) & (index->table_size - 1);
+    }
+    return NULL;
+}
+
+bool finder_index_entry_unchanged(const struct finder_index_entry *entry, const struct stat *st)
+{
+    return entry->size >= 0
+        && entry->ino == (uint64_t)st->st_ino
+        && entry->size == (int64_t)st->st_size
+        && entry->mtime_sec == (int64_t)st->st_mtim.tv_sec
+        && entry->mtime_nsec == (int64_t)st->st_mtim.tv_nsec;
+}
+
+void finder_index_entry_reset(struct finder_index_entry *entry, const struct stat *st)
+{
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime_sec = st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    entry->matches = 0;
+    free(entry->bloom);
+    entry->bloom = NULL;
+    entry->bloom_bits = 0;
+}
+
+void finder_index_entry_free(struct finder_index_entry *entry)
+{
+    free(entry->path);
+    free(entry->bloom);
+    free(entry);
+}
+
+bool finder_index_entry_set_trigrams(struct finder_index_entry *entry, struct finder_trigrams *trigrams,
+        const char *data, size_t len)
+{
+    /* beyond this many distinct trigrams even the largest filter would match nearly anything */
+    const size_t max_count = FINDER_INDEX_BLOOM_MAX_BITS / FINDER_INDEX_BLOOM_BITS_PER_TRIGRAM;
+    uint32_t trigram = 0;
+    uint32_t bits;
+    size_t i;
+    bool ok = true;
+
+    free(entry->bloom);
+    entry->bloom = NULL;
+    entry->bloom_bits = 0;
+    if(trigrams->seen == NULL)
+    {
+        trigrams->seen = calloc(FINDER_INDEX_TRIGRAMS / 8, 1);
+        if(trigrams->seen == NULL)
+        {
+            return false;
+        }
+    }
+
+    trigrams->count = 0;
+    for(i = 0; i < len; i++)
+    {
+        trigram = ((trigram << 8) | (unsigned char)data[i]) & 0xffffff;
+        if(i < 2 || (trigrams->seen[trigram / 8] & (1u << (trigram % 8))) != 0)
+        {
+            continue;
+        }
+        if(trigrams->count == max_count)
+        {
+            break;
+        }
+        if(trigrams->count == trigrams->capacity)
+        {
+            size_t capacity = trigrams->capacity ? trigrams->capacity * 2 : 4096;
+            uint32_t *list = realloc(trigrams->list, capacity * sizeof(*list));
+            if(list == NULL)
+            {
+                ok = false;
+                break;
+            }
+            trigrams->list = list;
+            trigrams->capacity = capacity;
+        }
+        trigrams->seen[trigram / 8] |= (uint8_t)(1u << (trigram % 8));
+        trigrams->list[trigrams->count++] = trigram;
+    }
+
+    if(ok && i == len)
+    {
+        for(bits = FINDER_INDEX_BLOOM_MIN_BITS;
+                bits < FINDER_INDEX_BLOOM_MAX_BITS && bits < trigrams->count * FINDER_INDEX_BLOOM_BITS_PER_TRIGRAM;
+                bits *= 2)
+        {
+        }
+        entry->bloom = calloc(bits / 8, 1);
+        ok = entry->bloom != NULL;
+        if(ok)
+        {
+            entry->bloom_bits = bits;
+            for(i = 0; i < trigrams->count; i++)
+            {
+                bloom_add(entry, trigrams->list[i]);
+            }
+        }
+    }
+
+    // every bit set in seen is one of the listed trigrams, clear them for the next file
+    for(i = 0; i < trigrams->count; i++)
+    {
+        trigrams->seen[trigrams->list[i] / 8] = 0;
+    }
+    return ok;
+}
+
+void finder_trigrams_free(struct finder_trigrams *trigrams)
+{
+    free(trigrams->seen);
+    free(trigrams->list);
+    memset(trigrams, 0, sizeof(*trigrams));
+}
+
+bool finder_index_entry_may_match(const struct finder_index_entry *entry, const char *needle, size_t needle_len)
+{
+    uint32_t trigram = 0;
+    size_t i;
+
+    if(entry->bloom_bits == 0)
+    {
+        return true;
+    }
+    for(i = 0; i < needle_len; i++)
+    {
+        trigram = ((trigram << 8) | (unsigned char)needle[i]) & 0xffffff;
+        if(i >= 2 && !bloom_contains(entry, trigram))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool finder_index_save(const char *path, uint64_t query_hash, struct finder_index_entry *const *entries,
+        size_t count, time_t scan_start)
+{
+    struct index_header header;
+    size_t pathlen = strlen(path);
+    char *tmppath = malloc(pathlen + 32);
+    FILE *file;
+    size_t i;
+    bool ok = true;
+
+    if(tmppath == NULL)
+    {
+        return false;
+    }
+    snprintf(tmppath, pathlen + 32, "%s.tmp.%ld", path, (long)getpid());
+
+    file = fopen(tmppath, "wb");
+    if(file == NULL)
+    {
+        free(tmppath);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+    header.bloom_hashes = FINDER_INDEX_BLOOM_HASHES;
+    header.query_hash = query_hash;
+    header.count = count;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for(i = 0; ok && i < count; i++)
+    {
+        const struct finder_index_entry *entry = entries[i];
+        struct index_record record;
+
+        memset(&record, 0, sizeof(record));
+        record.ino = entry->ino;
+        record.mtime_sec = entry->mtime_sec;
+        record.mtime_nsec = entry->mtime_nsec;
+        record.size = (entry->mtime_sec >= (int64_t)scan_start) ? -1 : entry->size;
+        record.matches = entry->matches;
+        record.path_len = (uint32_t)strlen(entry->path);
+        record.bloom_bits = entry->bloom_bits;
+        ok = fwrite(&record, sizeof(record), 1, file) == 1
+            && fwrite(entry->path, 1, record.path_len, file) == record.path_len
+            && fwrite(entry->bloom, 1, record.bloom_bits / 8, file) == record.bloom_bits / 8;
+    }
+
+    if(fclose(file) != 0)
+    {
+        ok = false;
+    }
+    if(ok)
+    {
+        ok = rename(tmppath, path) == 0;
+    }
+    if(!ok)
+    {
+        unlink(tmppath);
+    }
+    free(tmppath);
+    return ok;
+}
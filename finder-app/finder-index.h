@@ -0,0 +1,140 @@
+/*
+ * finder-index.h
+ *
+ * Optional on-disk index used by finder to answer repeated queries over a
+ * mostly static directory.  For every regular file the index remembers its
+ * inode, mtime and size, a bloom filter of the trigrams it contains and the
+ * number of lines which matched the search string of the previous run.
+ * The bloom filter is sized from the number of distinct trigrams in the file
+ * so its false positive rate stays near 1% however much text the file holds.
+ */
+
+#ifndef FINDER_INDEX_H
+#define FINDER_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* bits per distinct trigram, with FINDER_INDEX_BLOOM_HASHES this gives about 1% false positives */
+#define FINDER_INDEX_BLOOM_BITS_PER_TRIGRAM 10
+#define FINDER_INDEX_BLOOM_HASHES 7
+/* bounds of the size of a bloom filter, both powers of two */
+#define FINDER_INDEX_BLOOM_MIN_BITS 64
+#define FINDER_INDEX_BLOOM_MAX_BITS (1u << 24)
+/* trigrams are the last three bytes seen, so there are 2^24 of them */
+#define FINDER_INDEX_TRIGRAMS (1u << 24)
+
+struct finder_index_entry
+{
+    uint64_t ino;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    /**
+     * Size in bytes, -1 if the entry must be rescanned on the next run
+     */
+    int64_t size;
+    /**
+     * Matching lines for the query the index was saved with
+     */
+    uint32_t matches;
+    /**
+     * Bloom filter of every trigram in the file, bloom_bits bits.  With
+     * bloom_bits 0 there is no filter and the file may match anything.
+     */
+    uint8_t *bloom;
+    uint32_t bloom_bits;
+    /**
+     * Path relative to the searched directory
+     */
+    char *path;
+};
+
+struct finder_index
+{
+    /**
+     * finder_index_hash() of the search string the stored match counts refer to
+     */
+    uint64_t query_hash;
+    struct finder_index_entry *entries;
+    size_t count;
+    /* open addressing table of entry index + 1, 0 for an empty slot */
+    size_t *table;
+    size_t table_size;
+};
+
+/**
+ * Scratch space to collect the distinct trigrams of a file, one per worker thread
+ */
+struct finder_trigrams
+{
+    /* FINDER_INDEX_TRIGRAMS bits, allocated on first use and kept clear between files */
+    uint8_t *seen;
+    /* distinct trigrams of the current file in order of first occurrence */
+    uint32_t *list;
+    size_t count;
+    size_t capacity;
+};
+
+/**
+ * Load the index stored at @param path into @param index.  A missing or
+ * unreadable index file results in an empty index.
+ * @return false if memory could not be allocated
+ */
+bool finder_index_load(struct finder_index *index, const char *path);
+
+void finder_index_free(struct finder_index *index);
+
+/**
+ * @return the entry stored for @param path or NULL
+ */
+struct finder_index_entry *finder_index_lookup(const struct finder_index *index, const char *path);
+
+/**
+ * @return true if the file described by @param st is the one @param entry was built from
+ */
+bool finder_index_entry_unchanged(const struct finder_index_entry *entry, const struct stat *st);
+
+/**
+ * Reset @param entry to describe the file @param st without a bloom filter
+ */
+void finder_index_entry_reset(struct finder_index_entry *entry, const struct stat *st);
+
+/**
+ * Free an entry allocated by the caller rather than by finder_index_load()
+ */
+void finder_index_entry_free(struct finder_index_entry *entry);
+
+/**
+ * Build the bloom filter of @param entry from the trigrams of the @param len
+ * bytes at @param data, sized for the number of distinct ones.  @param trigrams
+ * is scratch space, zero initialized before the first call.
+ * @return false if memory could not be allocated, the entry then has no filter
+ */
+bool finder_index_entry_set_trigrams(struct finder_index_entry *entry, struct finder_trigrams *trigrams,
+        const char *data, size_t len);
+
+void finder_trigrams_free(struct finder_trigrams *trigrams);
+
+/**
+ * @return false if the file of @param entry cannot contain @param needle
+ */
+bool finder_index_entry_may_match(const struct finder_index_entry *entry, const char *needle, size_t needle_len);
+
+/**
+ * Atomically replace the index at @param path with @param count @param entries.
+ * Entries modified at or after @param scan_start are marked for a rescan, as
+ * their mtime cannot tell apart writes made later within the same tick.
+ * @return true on success
+ */
+bool finder_index_save(const char *path, uint64_t query_hash, struct finder_index_entry *const *entries,
+        size_t count, time_t scan_start);
+
+/**
+ * @return a 64 bit FNV-1a hash of the @param len bytes at @param data
+ */
+uint64_t finder_index_hash(const char *data, size_t len);
+
+#endif /* FINDER_INDEX_H */
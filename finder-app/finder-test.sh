@@ -53,10 +53,12 @@ fi
 #make clean
 #make
 
+# Create all files with a single writer process in bulk mode, reading one
+# "<file><TAB><content>" record per line
 for i in $( seq 1 $NUMFILES)
 do
-	./writer "$WRITEDIR/${username}$i.txt" "$WRITESTR"
-done
+	printf '%s\t%s\n' "${username}$i.txt" "$WRITESTR"
+done | ./writer -b -C "$WRITEDIR"
 
 OUTPUTSTRING=$(./finder.sh "$WRITEDIR" "$WRITESTR")
 
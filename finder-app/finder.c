@@ -0,0 +1,632 @@
+/**
+ * @file finder.c
+ * @brief Native replacement for the find | xargs grep | wc -l pipeline in finder.sh
+ *
+ * Walks <filesdir> once using openat() and getdents64(), hands every regular
+ * file to a pool of worker threads and counts the lines containing the fixed
+ * string <searchstr> with the kernels in line-search.c.  Small files are read
+ * with read(), large files are mapped with mmap().  Prints the same summary
+ * line as finder.sh.
+ *
+ * With -i the per file results are kept in an index file, see finder-index.h.
+ * Later runs only read files whose inode, size or mtime changed, or whose
+ * trigrams do not rule out a match for a different search string.
+ *
+ * Usage: finder [-j jobs] [-i indexfile] <filesdir> <searchstr>
+ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include "finder-index.h"
+#include "line-search.h"
+
+/* Files at least this large are mapped instead of read */
+#define FINDER_MMAP_THRESHOLD   (256 * 1024)
+#define FINDER_DIRENT_BUF_SIZE  (32 * 1024)
+#define FINDER_QUEUE_SIZE       256
+#define FINDER_MAX_JOBS         64
+
+struct linux_dirent64
+{
+    uint64_t        d_ino;
+    int64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+
+/**
+ * An open directory shared by the queued files it contains.  The descriptor
+ * is closed once the walker and all workers are done with it.
+ */
+struct finder_dir
+{
+    int fd;
+    atomic_int refs;
+    /**
+     * Path relative to <filesdir>, empty for <filesdir> itself
+     */
+    char *path;
+};
+
+struct finder_work
+{
+    struct finder_dir *dir;
+    char *name;
+    /**
+     * Index entry to fill in while searching the file, NULL without an index
+     */
+    struct finder_index_entry *entry;
+};
+
+struct finder_queue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    struct finder_work items[FINDER_QUEUE_SIZE];
+    unsigned int head;
+    unsigned int count;
+    bool done;
+};
+
+struct finder_state
+{
+    struct line_search search;
+    struct finder_queue queue;
+    unsigned long number_files;
+    atomic_ulong number_matching_lines;
+    /* index state, only used by the walker thread when index_path is set */
+    const char *index_path;
+    struct finder_index index;
+    uint64_t query_hash;
+    struct stat index_stat;
+    bool index_exists;
+    struct finder_index_entry **index_entries;
+    size_t index_entry_count;
+    size_t index_entry_capacity;
+};
+
+/**
+ * Result of checking a file against the index
+ */
+enum index_check
+{
+    INDEX_FILE_SEARCH,  /* the file must be searched */
+    INDEX_FILE_CACHED,  /* the matching lines are known without reading the file */
+    INDEX_FILE_IGNORE,  /* the file is the index itself */
+};
+
+static void dir_put(struct finder_dir *dir)
+{
+    if(atomic_fetch_sub(&dir->refs, 1) == 1)
+    {
+        close(dir->fd);
+        free(dir->path);
+        free(dir);
+    }
+}
+
+static void queue_push(struct finder_queue *queue, struct finder_dir *dir, const char *name,
+        struct finder_index_entry *entry)
+{
+    struct finder_work *work;
+    char *copy = strdup(name);
+
+    if(copy == NULL)
+    {
+        fprintf(stderr, "finder: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == FINDER_QUEUE_SIZE)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    }
+    work = &queue->items[(queue->head + queue->count) % FINDER_QUEUE_SIZE];
+    work->dir = dir;
+    work->name = copy;
+    work->entry = entry;
+    atomic_fetch_add(&dir->refs, 1);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static bool queue_pop(struct finder_queue *queue, struct finder_work *work)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->count == 0 && !queue->done)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+    if(queue->count == 0)
+    {
+        pthread_mutex_unlock(&queue->mutex);
+        return false;
+    }
+    *work = queue->items[queue->head];
+    queue->head = (queue->head + 1) % FINDER_QUEUE_SIZE;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+    return true;
+}
+
+static void queue_finish(struct finder_queue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->done = true;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+/**
+ * Count the matching lines of the @param len bytes at @param data and record
+ * them together with the file's trigrams in @param entry, if set.
+ * @param trigrams is the worker's scratch space for the trigrams.
+ */
+static unsigned long search_data(struct finder_state *state, struct finder_index_entry *entry,
+        struct finder_trigrams *trigrams, const struct stat *st, const char *data, size_t len)
+{
+    unsigned long lines = line_search_count(&state->search, data, len);
+
+    if(entry != NULL)
+    {
+        finder_index_entry_reset(entry, st);
+        // without memory for the bloom filter the entry just never rules out a match
+        finder_index_entry_set_trigrams(entry, trigrams, data, len);
+        entry->matches = (uint32_t)lines;
+    }
+    return lines;
+}
+
+/**
+ * Count the matching lines of @param name in @param dir.  @param buf and
+ * @param bufsize are a per worker read buffer which is grown as needed,
+ * @param trigrams the worker's scratch space for index entries.
+ */
+static unsigned long search_file(struct finder_state *state, struct finder_dir *dir, const char *name,
+        struct finder_index_entry *entry, struct finder_trigrams *trigrams, char **buf, size_t *bufsize)
+{
+    unsigned long lines = 0;
+    struct stat st;
+    int fd = openat(dir->fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+    if(fd < 0)
+    {
+        fprintf(stderr, "finder: %s%s%s: %s\n", dir->path, *dir->path ? "/" : "", name, strerror(errno));
+        if(entry != NULL)
+        {
+            entry->size = -1;
+        }
+        return 0;
+    }
+
+    if(fstat(fd, &st) != 0)
+    {
+        memset(&st, 0, sizeof(st));
+        st.st_size = -1;
+    }
+
+    if(st.st_size >= FINDER_MMAP_THRESHOLD)
+    {
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED)
+        {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            lines = search_data(state, entry, trigrams, &st, data, st.st_size);
+            munmap(data, st.st_size);
+            close(fd);
+            return lines;
+        }
+    }
+
+    // small files, and files whose size is unknown or which could not be mapped
+    {
+        size_t used = 0;
+        ssize_t n;
+
+        for(;;)
+        {
+            if(used == *bufsize)
+            {
+                size_t newsize = *bufsize ? *bufsize * 2 : FINDER_MMAP_THRESHOLD;
+                char *newbuf = realloc(*buf, newsize);
+                if(newbuf == NULL)
+                {
+                    fprintf(stderr, "finder: out of memory reading %s\n", name);
+                    break;
+                }
+                *buf = newbuf;
+                *bufsize = newsize;
+            }
+            n = read(fd, *buf + used, *bufsize - used);
+            if(n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(n <= 0)
+            {
+                break;
+            }
+            used += n;
+        }
+        lines = search_data(state, entry, trigrams, &st, *buf, used);
+    }
+
+    close(fd);
+    return lines;
+}
+
+static void *worker_thread(void *arg)
+{
+    struct finder_state *state = (struct finder_state *)arg;
+    struct finder_work work;
+    struct finder_trigrams trigrams;
+    char *buf = NULL;
+    size_t bufsize = 0;
+
+    memset(&trigrams, 0, sizeof(trigrams));
+    while(queue_pop(&state->queue, &work))
+    {
+        unsigned long lines = search_file(state, work.dir, work.name, work.entry, &trigrams, &buf, &bufsize);
+        atomic_fetch_add_explicit(&state->number_matching_lines, lines, memory_order_relaxed);
+        free(work.name);
+        dir_put(work.dir);
+    }
+
+    free(buf);
+    finder_trigrams_free(&trigrams);
+    return NULL;
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+    size_t dirlen = strlen(dir);
+    size_t namelen = strlen(name);
+    char *path = malloc(dirlen + namelen + 2);
+
+    if(path == NULL)
+    {
+        return NULL;
+    }
+    memcpy(path, dir, dirlen);
+    if(dirlen != 0)
+    {
+        path[dirlen++] = '/';
+    }
+    memcpy(path + dirlen, name, namelen + 1);
+    return path;
+}
+
+/**
+ * Look up @param name in @param dir in the index.  Sets @param entry to the
+ * entry to be carried over into the new index, which the worker has to fill
+ * in when INDEX_FILE_SEARCH is returned.
+ */
+static enum index_check index_check_file(struct finder_state *state, struct finder_dir *dir, const char *name,
+        struct finder_index_entry **entry)
+{
+    struct finder_index_entry *found;
+    struct stat st;
+    char *path;
+    enum index_check result = INDEX_FILE_SEARCH;
+
+    *entry = NULL;
+    if(fstatat(dir->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        return INDEX_FILE_SEARCH;
+    }
+    if(state->index_exists && st.st_dev == state->index_stat.st_dev && st.st_ino == state->index_stat.st_ino)
+    {
+        return INDEX_FILE_IGNORE;
+    }
+
+    path = join_path(dir->path, name);
+    if(path == NULL)
+    {
+        return INDEX_FILE_SEARCH;
+    }
+
+    found = finder_index_lookup(&state->index, path);
+    if(found != NULL && finder_index_entry_unchanged(found, &st))
+    {
+        if(state->index.query_hash == state->query_hash)
+        {
+            result = INDEX_FILE_CACHED;
+        }
+        else if(!finder_index_entry_may_match(found, state->search.needle, state->search.needle_len))
+        {
+            found->matches = 0;
+            result = INDEX_FILE_CACHED;
+        }
+        free(path);
+        *entry = found;
+    }
+    else
+    {
+        *entry = calloc(1, sizeof(**entry));
+        if(*entry == NULL)
+        {
+            free(path);
+            return INDEX_FILE_SEARCH;
+        }
+        (*entry)->path = path;
+        (*entry)->size = -1;
+    }
+
+    if(result == INDEX_FILE_CACHED)
+    {
+        atomic_fetch_add_explicit(&state->number_matching_lines, (*entry)->matches, memory_order_relaxed);
+    }
+
+    if(state->index_entry_count == state->index_entry_capacity)
+    {
+        size_t capacity = state->index_entry_capacity ? state->index_entry_capacity * 2 : 1024;
+        struct finder_index_entry **entries = realloc(state->index_entries, capacity * sizeof(*entries));
+        if(entries == NULL)
+        {
+            // the file is still searched, it just will not be in the next index
+            if(found == NULL)
+            {
+                finder_index_entry_free(*entry);
+            }
+            *entry = NULL;
+            return result;
+        }
+        state->index_entries = entries;
+        state->index_entry_capacity = capacity;
+    }
+    state->index_entries[state->index_entry_count++] = *entry;
+    return result;
+}
+
+static bool index_entry_is_loaded(const struct finder_index *index, const struct finder_index_entry *entry)
+{
+    return entry >= index->entries && entry < index->entries + index->count;
+}
+
+/**
+ * Queue every regular file below @param dir and recurse into subdirectories.
+ * Symbolic links are neither followed nor counted, matching find -type f.
+ */
+static void walk_dir(struct finder_state *state, struct finder_dir *dir)
+{
+    char *dirent_buf = malloc(FINDER_DIRENT_BUF_SIZE);
+    long nread;
+
+    if(dirent_buf == NULL)
+    {
+        fprintf(stderr, "finder: out of memory\n");
+        return;
+    }
+
+    while((nread = syscall(SYS_getdents64, dir->fd, dirent_buf, FINDER_DIRENT_BUF_SIZE)) > 0)
+    {
+        long offset;
+
+        for(offset = 0; offset < nread;)
+        {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(dirent_buf + offset);
+            unsigned char type = d->d_type;
+
+            offset += d->d_reclen;
+            if(strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+            {
+                continue;
+            }
+
+            if(type == DT_UNKNOWN)
+            {
+                struct stat st;
+                if(fstatat(dir->fd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                {
+                    continue;
+                }
+                type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+            }
+
+            if(type == DT_REG)
+            {
+                struct finder_index_entry *entry = NULL;
+
+                if(state->index_path != NULL)
+                {
+                    enum index_check check = index_check_file(state, dir, d->d_name, &entry);
+                    if(check == INDEX_FILE_IGNORE)
+                    {
+                        continue;
+                    }
+                    if(check == INDEX_FILE_CACHED)
+                    {
+                        state->number_files++;
+                        continue;
+                    }
+                }
+                state->number_files++;
+                queue_push(&state->queue, dir, d->d_name, entry);
+            }
+            else if(type == DT_DIR)
+            {
+                struct finder_dir *sub = calloc(1, sizeof(*sub));
+                if(sub == NULL)
+                {
+                    continue;
+                }
+                sub->fd = openat(dir->fd, d->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                sub->path = join_path(dir->path, d->d_name);
+                if(sub->fd < 0 || sub->path == NULL)
+                {
+                    fprintf(stderr, "finder: cannot open directory %s\n", d->d_name);
+                    if(sub->fd >= 0)
+                    {
+                        close(sub->fd);
+                    }
+                    free(sub->path);
+                    free(sub);
+                    continue;
+                }
+                atomic_init(&sub->refs, 1);
+                walk_dir(state, sub);
+                dir_put(sub);
+            }
+        }
+    }
+
+    if(nread < 0)
+    {
+        fprintf(stderr, "finder: reading directory %s failed: %s\n", dir->path, strerror(errno));
+    }
+    free(dirent_buf);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-j jobs] [-i indexfile] <filesdir> <searchstr>\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct finder_state state;
+    struct finder_dir *root;
+    pthread_t workers[FINDER_MAX_JOBS];
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *index_path = NULL;
+    time_t scan_start = time(NULL);
+    int started = 0;
+    int opt;
+    int i;
+
+    while((opt = getopt(argc, argv, "j:i:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'j':
+                jobs = atol(optarg);
+                break;
+            case 'i':
+                index_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if(argc - optind != 2)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(jobs < 1)
+    {
+        jobs = 1;
+    }
+    if(jobs > FINDER_MAX_JOBS)
+    {
+        jobs = FINDER_MAX_JOBS;
+    }
+
+    memset(&state, 0, sizeof(state));
+    if(strchr(argv[optind + 1], '\n') != NULL)
+    {
+        fprintf(stderr, "finder: <searchstr> must not contain a newline\n");
+        exit(EXIT_FAILURE);
+    }
+    line_search_init(&state.search, argv[optind + 1], strlen(argv[optind + 1]), LINE_SEARCH_AUTO);
+    pthread_mutex_init(&state.queue.mutex, NULL);
+    pthread_cond_init(&state.queue.not_empty, NULL);
+    pthread_cond_init(&state.queue.not_full, NULL);
+    atomic_init(&state.number_matching_lines, 0);
+
+    if(index_path != NULL)
+    {
+        state.index_path = index_path;
+        state.query_hash = finder_index_hash(state.search.needle, state.search.needle_len);
+        state.index_exists = stat(index_path, &state.index_stat) == 0;
+        if(!finder_index_load(&state.index, index_path))
+        {
+            fprintf(stderr, "finder: out of memory loading index %s\n", index_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    root = calloc(1, sizeof(*root));
+    if(root == NULL)
+    {
+        exit(EXIT_FAILURE);
+    }
+    root->fd = open(argv[optind], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    root->path = strdup("");
+    if(root->fd < 0 || root->path == NULL)
+    {
+        usage(argv[0]);
+        printf("<filesdir> needs to be a directory\n");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&root->refs, 1);
+
+    for(i = 0; i < jobs; i++)
+    {
+        if(pthread_create(&workers[started], NULL, worker_thread, &state) == 0)
+        {
+            started++;
+        }
+    }
+    if(started == 0)
+    {
+        fprintf(stderr, "finder: could not start any worker thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    walk_dir(&state, root);
+    dir_put(root);
+    queue_finish(&state.queue);
+
+    for(i = 0; i < started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+
+    if(index_path != NULL)
+    {
+        size_t n;
+
+        if(!finder_index_save(index_path, state.query_hash, state.index_entries, state.index_entry_count,
+                    scan_start))
+        {
+            fprintf(stderr, "finder: could not write index %s\n", index_path);
+        }
+        for(n = 0; n < state.index_entry_count; n++)
+        {
+            if(!index_entry_is_loaded(&state.index, state.index_entries[n]))
+            {
+                finder_index_entry_free(state.index_entries[n]);
+            }
+        }
+        free(state.index_entries);
+        finder_index_free(&state.index);
+    }
+
+    printf("The number of files are %lu and the number of matching lines are %lu\n",
+            state.number_files, atomic_load(&state.number_matching_lines));
+
+    exit(EXIT_SUCCESS);
+}
@@ -16,6 +16,15 @@ then
 	exit 1
 fi
 
+# Prefer the native finder built by the Makefile, it walks the tree once and
+# handles file names containing spaces.  Set FINDER_INDEX to an index file
+# path to reuse the results of earlier runs over the same directory.
+finder_bin="$(dirname "$0")/finder"
+if [ -x "$finder_bin" ]
+then
+	exec "$finder_bin" ${FINDER_INDEX:+-i "$FINDER_INDEX"} -- "$filesdir" "$searchstr"
+fi
+
 number_files=`find $filesdir -type f | wc -l`
 number_matching_lines=`find $filesdir -type f | xargs grep $searchstr | wc -l`
 
@@ -0,0 +1,184 @@
+/**
+ * @file line-search-bench.c
+ * @brief Throughput benchmark for the line-search.h kernels
+ *
+ * Generates synthetic corpora of random text lines of varying size and match
+ * density, checks that every supported implementation counts the same number
+ * of matching lines as the scalar one and prints the throughput of each.
+ *
+ * Usage: line-search-bench [-n needle] [-s size_bytes,...] [-m matches_per_1000_lines,...]
+ */
+
+#define _GNU_SOURCE
+#include "line-search.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_LIST_ENTRIES 16
+#define MIN_LINE_LEN 20
+#define MAX_LINE_LEN 120
+/* Each measurement repeats the search until at least this much time passed */
+#define MIN_MEASURE_NS 50000000ull
+
+static const enum line_search_impl impls[] = {
+    LINE_SEARCH_SCALAR,
+    LINE_SEARCH_SSE2,
+    LINE_SEARCH_AVX2,
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Fill @param size bytes of @param corpus with lines of lower case words,
+ * placing @param needle into about @param per_mille of every 1000 lines.
+ * @return the number of lines that received the needle
+ */
+static unsigned long generate_corpus(char *corpus, size_t size, const char *needle, unsigned int per_mille)
+{
+    size_t needle_len = strlen(needle);
+    unsigned long planted = 0;
+    size_t pos = 0;
+
+    while(pos < size)
+    {
+        size_t line_len = MIN_LINE_LEN + (size_t)(rand() % (MAX_LINE_LEN - MIN_LINE_LEN));
+        size_t i;
+
+        if(line_len > size - pos)
+        {
+            line_len = size - pos;
+        }
+        for(i = 0; i < line_len; i++)
+        {
+            int r = rand() % 27;
+            corpus[pos + i] = (r == 26) ? ' ' : (char)('a' + r);
+        }
+        if(line_len > needle_len + 1 && (unsigned int)(rand() % 1000) < per_mille)
+        {
+            size_t at = (size_t)rand() % (line_len - needle_len - 1);
+            memcpy(&corpus[pos + at], needle, needle_len);
+            planted++;
+        }
+        corpus[pos + line_len - 1] = '\n';
+        pos += line_len;
+    }
+    return planted;
+}
+
+static int parse_list(char *arg, unsigned long *values)
+{
+    int count = 0;
+    char *saveptr = NULL;
+    char *token;
+
+    for(token = strtok_r(arg, ",", &saveptr); token != NULL && count < MAX_LIST_ENTRIES;
+            token = strtok_r(NULL, ",", &saveptr))
+    {
+        values[count++] = strtoul(token, NULL, 0);
+    }
+    return count;
+}
+
+int main(int argc, char **argv)
+{
+    const char *needle = "AELD_IS_FUN";
+    unsigned long sizes[MAX_LIST_ENTRIES] = { 4096, 65536, 1 << 20, 16 << 20 };
+    int size_count = 4;
+    unsigned long densities[MAX_LIST_ENTRIES] = { 0, 1, 10, 100, 1000 };
+    int density_count = 5;
+    bool ok = true;
+    int opt;
+    int s;
+    int d;
+    size_t i;
+
+    while((opt = getopt(argc, argv, "n:s:m:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'n':
+                needle = optarg;
+                break;
+            case 's':
+                size_count = parse_list(optarg, sizes);
+                break;
+            case 'm':
+                density_count = parse_list(optarg, densities);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n needle] [-s size_bytes,...] "
+                        "[-m matches_per_1000_lines,...]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    srand(1);
+    printf("%-10s %9s %-7s %10s %10s\n", "size", "per_mille", "impl", "matches", "MB/s");
+
+    for(s = 0; s < size_count; s++)
+    {
+        char *corpus = malloc(sizes[s]);
+        if(corpus == NULL)
+        {
+            fprintf(stderr, "Could not allocate %lu bytes\n", sizes[s]);
+            return EXIT_FAILURE;
+        }
+
+        for(d = 0; d < density_count; d++)
+        {
+            unsigned long expected;
+
+            generate_corpus(corpus, sizes[s], needle, (unsigned int)densities[d]);
+            {
+                struct line_search scalar;
+                line_search_init(&scalar, needle, strlen(needle), LINE_SEARCH_SCALAR);
+                expected = line_search_count(&scalar, corpus, sizes[s]);
+            }
+
+            for(i = 0; i < sizeof(impls) / sizeof(impls[0]); i++)
+            {
+                struct line_search search;
+                unsigned long matches = 0;
+                unsigned long iterations = 0;
+                uint64_t start;
+                uint64_t elapsed;
+
+                if(!line_search_init(&search, needle, strlen(needle), impls[i]))
+                {
+                    continue;
+                }
+
+                start = now_ns();
+                do
+                {
+                    matches = line_search_count(&search, corpus, sizes[s]);
+                    iterations++;
+                    elapsed = now_ns() - start;
+                } while(elapsed < MIN_MEASURE_NS);
+
+                printf("%-10lu %9lu %-7s %10lu %10.0f\n", sizes[s], densities[d],
+                        line_search_impl_name(impls[i]), matches,
+                        (double)sizes[s] * iterations * 1e3 / (double)elapsed);
+
+                if(matches != expected)
+                {
+                    fprintf(stderr, "%s counted %lu matching lines, scalar counted %lu\n",
+                            line_search_impl_name(impls[i]), matches, expected);
+                    ok = false;
+                }
+            }
+        }
+        free(corpus);
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
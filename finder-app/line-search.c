@@ -0,0 +1,260 @@
+/**
+ * @file line-search.c
+ * @brief Scalar, SSE2 and AVX2 kernels counting the lines containing a fixed string
+ *
+ * The vector kernels compare a block of candidate start positions against the
+ * first byte of the needle and the block shifted by needle_len - 1 against its
+ * last byte.  Only positions where both bytes match are verified with memcmp().
+ * Once a match is found the rest of its line is skipped with memchr(), so each
+ * line is counted at most once without splitting the data into lines first.
+ */
+
+#define _GNU_SOURCE
+#include "line-search.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LINE_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * Scalar search of @param data starting at @param start, which must not be
+ * inside a line that was already counted
+ */
+static unsigned long count_scalar_from(const struct line_search *search, const char *data, size_t len,
+        size_t start)
+{
+    const char *pos = data + start;
+    const char *end = data + len;
+    unsigned long lines = 0;
+
+    while(pos < end)
+    {
+        const char *match = memmem(pos, end - pos, search->needle, search->needle_len);
+        const char *eol;
+
+        if(match == NULL)
+        {
+            break;
+        }
+        lines++;
+        eol = memchr(match + search->needle_len, '\n', end - (match + search->needle_len));
+        if(eol == NULL)
+        {
+            break;
+        }
+        pos = eol + 1;
+    }
+    return lines;
+}
+
+static unsigned long count_scalar(const struct line_search *search, const char *data, size_t len)
+{
+    return count_scalar_from(search, data, len, 0);
+}
+
+/**
+ * An empty needle matches every line
+ */
+static unsigned long count_all_lines(const struct line_search *search, const char *data, size_t len)
+{
+    const char *pos = data;
+    const char *end = data + len;
+    unsigned long lines = 0;
+
+    (void)search;
+    while(pos < end)
+    {
+        const char *eol = memchr(pos, '\n', end - pos);
+        lines++;
+        if(eol == NULL)
+        {
+            break;
+        }
+        pos = eol + 1;
+    }
+    return lines;
+}
+
+/**
+ * Handle a candidate at @param pos whose first and last byte matched.
+ * @return true if it is a real match, in which case @param next is set to the
+ *   start of the following line or to @param len if there is none
+ */
+static inline bool verify_candidate(const struct line_search *search, const char *data, size_t len,
+        size_t pos, size_t *next)
+{
+    const size_t n = search->needle_len;
+    const char *eol;
+
+    if(n > 2 && memcmp(data + pos + 1, search->needle + 1, n - 2) != 0)
+    {
+        return false;
+    }
+    eol = memchr(data + pos + n, '\n', len - pos - n);
+    *next = (eol == NULL) ? len : (size_t)(eol + 1 - data);
+    return true;
+}
+
+#ifdef LINE_SEARCH_X86
+
+__attribute__((target("sse2")))
+static unsigned long count_sse2(const struct line_search *search, const char *data, size_t len)
+{
+    const size_t n = search->needle_len;
+    const __m128i first = _mm_set1_epi8(search->needle[0]);
+    const __m128i last = _mm_set1_epi8(search->needle[n - 1]);
+    unsigned long lines = 0;
+    size_t i = 0;
+
+    while(i + n - 1 + 16 <= len)
+    {
+        const __m128i block_first = _mm_loadu_si128((const __m128i *)(data + i));
+        const __m128i block_last = _mm_loadu_si128((const __m128i *)(data + i + n - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                    _mm_cmpeq_epi8(last, block_last)));
+        size_t next = i + 16;
+
+        while(mask != 0)
+        {
+            if(verify_candidate(search, data, len, i + __builtin_ctz(mask), &next))
+            {
+                lines++;
+                break;
+            }
+            mask &= mask - 1;
+        }
+        i = next;
+    }
+
+    if(i >= len)
+    {
+        return lines;
+    }
+    return lines + count_scalar_from(search, data, len, i);
+}
+
+__attribute__((target("avx2")))
+static unsigned long count_avx2(const struct line_search *search, const char *data, size_t len)
+{
+    const size_t n = search->needle_len;
+    const __m256i first = _mm256_set1_epi8(search->needle[0]);
+    const __m256i last = _mm256_set1_epi8(search->needle[n - 1]);
+    unsigned long lines = 0;
+    size_t i = 0;
+
+    while(i + n - 1 + 32 <= len)
+    {
+        const __m256i block_first = _mm256_loadu_si256((const __m256i *)(data + i));
+        const __m256i block_last = _mm256_loadu_si256((const __m256i *)(data + i + n - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                    _mm256_cmpeq_epi8(last, block_last)));
+        size_t next = i + 32;
+
+        while(mask != 0)
+        {
+            if(verify_candidate(search, data, len, i + __builtin_ctz(mask), &next))
+            {
+                lines++;
+                break;
+            }
+            mask &= mask - 1;
+        }
+        i = next;
+    }
+
+    if(i >= len)
+    {
+        return lines;
+    }
+    return lines + count_scalar_from(search, data, len, i);
+}
+
+#endif /* LINE_SEARCH_X86 */
+
+bool line_search_supported(enum line_search_impl impl)
+{
+    switch(impl)
+    {
+        case LINE_SEARCH_AUTO:
+        case LINE_SEARCH_SCALAR:
+            return true;
+#ifdef LINE_SEARCH_X86
+        case LINE_SEARCH_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case LINE_SEARCH_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+bool line_search_init(struct line_search *search, const char *needle, size_t needle_len,
+        enum line_search_impl impl)
+{
+    search->needle = needle;
+    search->needle_len = needle_len;
+
+    if(impl == LINE_SEARCH_AUTO)
+    {
+        if(line_search_supported(LINE_SEARCH_AVX2))
+        {
+            impl = LINE_SEARCH_AVX2;
+        }
+        else if(line_search_supported(LINE_SEARCH_SSE2))
+        {
+            impl = LINE_SEARCH_SSE2;
+        }
+        else
+        {
+            impl = LINE_SEARCH_SCALAR;
+        }
+    }
+    else if(!line_search_supported(impl))
+    {
+        return false;
+    }
+    search->impl = impl;
+
+    if(needle_len == 0)
+    {
+        search->count = count_all_lines;
+        return true;
+    }
+
+    switch(impl)
+    {
+#ifdef LINE_SEARCH_X86
+        case LINE_SEARCH_SSE2:
+            search->count = count_sse2;
+            break;
+        case LINE_SEARCH_AVX2:
+            search->count = count_avx2;
+            break;
+#endif
+        default:
+            search->count = count_scalar;
+            break;
+    }
+    return true;
+}
+
+const char *line_search_impl_name(enum line_search_impl impl)
+{
+    switch(impl)
+    {
+        case LINE_SEARCH_AUTO:
+            return "auto";
+        case LINE_SEARCH_SCALAR:
+            return "scalar";
+        case LINE_SEARCH_SSE2:
+            return "sse2";
+        case LINE_SEARCH_AVX2:
+            return "avx2";
+        default:
+            return "unknown";
+    }
+}
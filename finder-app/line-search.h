@@ -0,0 +1,60 @@
+/*
+ * line-search.h
+ *
+ * Fixed string search kernel counting the lines which contain a needle.
+ * The data is scanned once without splitting it into lines first; SSE2 and
+ * AVX2 variants filter candidate positions by comparing the first and last
+ * byte of the needle 16 or 32 positions at a time.
+ */
+
+#ifndef LINE_SEARCH_H
+#define LINE_SEARCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum line_search_impl
+{
+    LINE_SEARCH_AUTO,       /* best implementation supported by the running CPU */
+    LINE_SEARCH_SCALAR,
+    LINE_SEARCH_SSE2,
+    LINE_SEARCH_AVX2,
+};
+
+struct line_search
+{
+    const char *needle;
+    size_t needle_len;
+    enum line_search_impl impl;
+    unsigned long (*count)(const struct line_search *search, const char *data, size_t len);
+};
+
+/**
+ * Prepare @param search to look for the @param needle_len bytes at @param needle,
+ * which must stay valid while @param search is used and must not contain a newline.
+ * @param impl selects the implementation, LINE_SEARCH_AUTO picks the fastest one the CPU supports.
+ * @return false if @param impl is not supported by this CPU or build
+ */
+bool line_search_init(struct line_search *search, const char *needle, size_t needle_len,
+        enum line_search_impl impl);
+
+/**
+ * @return the number of lines in the @param len bytes at @param data which contain the needle.
+ *   A final line without a trailing newline is counted like any other line.
+ */
+static inline unsigned long line_search_count(const struct line_search *search, const char *data, size_t len)
+{
+    return search->count(search, data, len);
+}
+
+/**
+ * @return true if @param impl can be used on this CPU
+ */
+bool line_search_supported(enum line_search_impl impl);
+
+/**
+ * @return a short name such as "avx2" for @param impl
+ */
+const char *line_search_impl_name(enum line_search_impl impl);
+
+#endif /* LINE_SEARCH_H */
@@ -97,6 +97,12 @@ cd ${FINDER_APP_DIR}
 make clean
 make CROSS_COMPILE=aarch64-none-linux-gnu-
 cp  writer ${OUTDIR}/rootfs/home
+cp  finder ${OUTDIR}/rootfs/home
+
+# Load generator for the aesdchar driver
+make -C ../aesd-char-driver -f Makefile_test clean
+make -C ../aesd-char-driver -f Makefile_test CC=${CROSS_COMPILE}gcc aesdchar-stress
+cp  ../aesd-char-driver/aesdchar-stress ${OUTDIR}/rootfs/home
 
 
 # TODO: Copy the finder related scripts and executables to the /home directory
@@ -1,13 +1,234 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
+#include <unistd.h>
+
+#include "async-log.h"
+
+/* Number of failed writes logged individually in bulk mode before summarizing */
+#define BULK_MAX_ERROR_LOGS 10
+
+enum sync_policy {
+	SYNC_NONE,	/* leave writeback to the kernel, like the single file mode */
+	SYNC_EACH,	/* fsync() every file before closing it */
+	SYNC_END,	/* syncfs() the target file system once after all files */
+};
+
+struct bulk_stats {
+	unsigned long files;
+	unsigned long bytes;
+	unsigned long errors;
+};
+
+static void bulk_error(struct bulk_stats *stats, const char *path, const char *what)
+{
+	stats->errors++;
+	if(stats->errors <= BULK_MAX_ERROR_LOGS) {
+		ASYNC_LOG(LOG_ERR, "Error while %s %s: %s", what, path, strerror(errno));
+	}
+}
+
+/*
+ * Create @path relative to @dirfd and write the @len bytes at @content to it.
+ */
+static void bulk_write_file(int dirfd, const char *path, const char *content, size_t len,
+		enum sync_policy sync, struct bulk_stats *stats)
+{
+	size_t written = 0;
+	int fd = openat(dirfd, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+	if(fd < 0) {
+		bulk_error(stats, path, "creating");
+		return;
+	}
+
+	while(written < len) {
+		ssize_t n = pwrite(fd, content + written, len - written, written);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			bulk_error(stats, path, "writing");
+			close(fd);
+			return;
+		}
+		written += n;
+	}
+
+	if(sync == SYNC_EACH && fsync(fd) != 0) {
+		bulk_error(stats, path, "syncing");
+	}
+	if(close(fd) != 0) {
+		bulk_error(stats, path, "closing");
+		return;
+	}
+	stats->files++;
+	stats->bytes += len;
+}
+
+/*
+ * Read (path, content) records from @input and write each of them.  Records
+ * are "path<TAB>content<LF>" lines, or "path<NUL>content<NUL>" pairs when
+ * @nul_separated is set.  As in the single file mode no newline is appended
+ * to the content.
+ */
+static int bulk_mode(FILE *input, int dirfd, int nul_separated, enum sync_policy sync)
+{
+	struct bulk_stats stats = {0, 0, 0};
+	char *record = NULL;
+	size_t record_size = 0;
+	char *content = NULL;
+	size_t content_size = 0;
+	ssize_t len;
+
+	while((len = getdelim(&record, &record_size, nul_separated ? '\0' : '\n', input)) > 0) {
+		char *path = record;
+		char *value;
+		size_t value_len;
+
+		if(record[len - 1] == (nul_separated ? '\0' : '\n')) {
+			record[--len] = '\0';
+		}
+
+		if(nul_separated) {
+			ssize_t clen = getdelim(&content, &content_size, '\0', input);
+			if(clen <= 0) {
+				errno = EINVAL;
+				bulk_error(&stats, path, "reading content for");
+				break;
+			}
+			if(content[clen - 1] == '\0') {
+				clen--;
+			}
+			value = content;
+			value_len = clen;
+		}
+		else {
+			value = memchr(record, '\t', len);
+			if(value == NULL) {
+				errno = EINVAL;
+				bulk_error(&stats, path, "parsing record for");
+				continue;
+			}
+			*value++ = '\0';
+			value_len = len - (value - record);
+		}
+
+		if(*path == '\0') {
+			continue;
+		}
+		bulk_write_file(dirfd, path, value, value_len, sync, &stats);
+	}
+
+	if(sync == SYNC_END && syncfs(dirfd) != 0) {
+		ASYNC_LOG(LOG_ERR, "Error while syncing written files: %s", strerror(errno));
+		stats.errors++;
+	}
+
+	if(stats.errors > BULK_MAX_ERROR_LOGS) {
+		ASYNC_LOG(LOG_ERR, "%lu further errors not logged", stats.errors - BULK_MAX_ERROR_LOGS);
+	}
+	ASYNC_LOG(LOG_DEBUG, "Wrote %lu files with %lu bytes, %lu errors.", stats.files, stats.bytes, stats.errors);
+
+	free(record);
+	free(content);
+	return stats.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static int bulk_main(int argc, char **argv)
+{
+	enum sync_policy sync = SYNC_NONE;
+	const char *manifest = NULL;
+	int dirfd = -1;
+	int nul_separated = 0;
+	FILE *input = stdin;
+	int opt;
+	int rc;
+
+	while((opt = getopt(argc, argv, "bC:f:0s:")) != -1) {
+		switch(opt) {
+		case 'b':
+			break;
+		case 'C':
+			dirfd = open(optarg, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if(dirfd < 0) {
+				ASYNC_LOG(LOG_ERR, "Error while opening directory %s: %s", optarg, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'f':
+			manifest = optarg;
+			break;
+		case '0':
+			nul_separated = 1;
+			break;
+		case 's':
+			if(strcmp(optarg, "none") == 0) {
+				sync = SYNC_NONE;
+			}
+			else if(strcmp(optarg, "each") == 0) {
+				sync = SYNC_EACH;
+			}
+			else if(strcmp(optarg, "end") == 0) {
+				sync = SYNC_END;
+			}
+			else {
+				ASYNC_LOG(LOG_ERR, "Unknown sync policy %s", optarg);
+				exit(EXIT_FAILURE);
+			}
+			break;
+		default:
+			ASYNC_LOG(LOG_ERR, "Usage %s -b [-C dir] [-f manifest] [-0] [-s none|each|end]", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(dirfd < 0) {
+		dirfd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(dirfd < 0) {
+			ASYNC_LOG(LOG_ERR, "Error while opening the current directory: %s", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(manifest != NULL) {
+		input = fopen(manifest, "r");
+		if(input == NULL) {
+			ASYNC_LOG(LOG_ERR, "Error while opening manifest %s: %s", manifest, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	rc = bulk_mode(input, dirfd, nul_separated, sync);
+
+	if(input != stdin) {
+		fclose(input);
+	}
+	close(dirfd);
+	return rc;
+}
 
 int main(int argc, char **argv)
 {
+	struct async_log_config log_config = {
+		.sink = ASYNC_LOG_SINK_SYSLOG,
+	};
+
+	/* messages reach syslog from the logging thread, exit() flushes them */
 	openlog(NULL, 0, LOG_USER);
+	async_log_init(&log_config);
+
+	if(argc >= 2 && strcmp(argv[1], "-b") == 0) {
+		exit(bulk_main(argc, argv));
+	}
 
 	if(argc != 3) {
-		syslog(LOG_ERR, "Usage %s <writefile> <writestr>", argv[0]);
+		ASYNC_LOG(LOG_ERR, "Usage %s <writefile> <writestr>", argv[0]);
+		ASYNC_LOG(LOG_ERR, "Usage %s -b [-C dir] [-f manifest] [-0] [-s none|each|end]", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 
@@ -15,15 +236,15 @@ int main(int argc, char **argv)
 
 	if(fileptr != NULL){
 		if(fputs(argv[2], fileptr) != EOF) {
-			syslog(LOG_DEBUG, "Writing %s to %s.", argv[2], argv[1]);
+			ASYNC_LOG(LOG_DEBUG, "Writing %s to %s.", argv[2], argv[1]);
 		}	
 		else {
-			syslog(LOG_ERR, "Error while writing %s to %s.", argv[2], argv[1]);
+			ASYNC_LOG(LOG_ERR, "Error while writing %s to %s.", argv[2], argv[1]);
 			exit(EXIT_FAILURE);
 		}
 	}
 	else {
-		syslog(LOG_ERR, "Error while writing %s to %s.", argv[2], argv[1]);
+		ASYNC_LOG(LOG_ERR, "Error while writing %s to %s.", argv[2], argv[1]);
 		exit(EXIT_FAILURE);
 	}
 
@@ -0,0 +1,540 @@
+/**
+ * @file aesdstream-bench.c
+ * @brief Clients against throughput benchmark and test client for aesdstream
+ *
+ * For every client count the benchmark connects that many clients, each in
+ * its own thread, and runs them for the given duration.
+ *
+ * In stream mode every client keeps one connection and sends lines as fast
+ * as the server accepts them while reading and discarding the replies, so the
+ * server's backpressure limits the rate.  In request mode every request
+ * connects, sends one line, half closes the connection and reads the reply
+ * until the server closes, as nc -N does, and the latency of the whole
+ * exchange is recorded.
+ *
+ * Lines have the form "client C line N xxx...", which aesdstream-test.sh
+ * uses to check that lines of concurrent clients were never mixed.
+ *
+ * With -x the tool instead sends TEXT as one line, prints the reply and exits.
+ *
+ * Usage: aesdstream-bench [-u socket_path | -p port] [-a address] [-c clients,...]
+ *                         [-d duration_ms] [-l line_len] [-m stream|request]
+ *        aesdstream-bench [-u socket_path | -p port] [-a address] -x TEXT
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_COUNTS 16
+#define BENCH_MAX_LINE 65536
+#define BENCH_READ_SIZE 65536
+/* latency samples kept per client in request mode */
+#define BENCH_MAX_SAMPLES 100000
+
+enum bench_mode
+{
+    MODE_STREAM,
+    MODE_REQUEST,
+};
+
+struct bench_config
+{
+    const char *unix_path;
+    const char *address;
+    int port;
+    int counts[BENCH_MAX_COUNTS];
+    int count_count;
+    unsigned int duration_ms;
+    size_t line_len;
+    enum bench_mode mode;
+};
+
+struct bench_client
+{
+    pthread_t tid;
+    int index;
+    const struct bench_config *config;
+    atomic_bool *stop;
+    unsigned long long lines;
+    unsigned long long reply_bytes;
+    unsigned long long errors;
+    uint64_t *samples;
+    size_t sample_count;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int connect_server(const struct bench_config *config)
+{
+    int fd;
+    int one = 1;
+
+    if(config->unix_path != NULL)
+    {
+        struct sockaddr_un addr;
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+        {
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, config->unix_path, sizeof(addr.sun_path) - 1);
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_in addr;
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+        {
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)config->port);
+        inet_pton(AF_INET, config->address, &addr.sin_addr);
+        if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            close(fd);
+            return -1;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+/**
+ * Fill @param line with line number @param n of @param client
+ * @return the length of the line including the newline
+ */
+static size_t make_line(char *line, size_t line_len, int client, unsigned long long n)
+{
+    /* the buffer has room for line_len plus a 64 byte prefix */
+    int len = snprintf(line, 64, "client %d line %llu ", client, n);
+
+    if((size_t)len + 1 > line_len)
+    {
+        line_len = (size_t)len + 1;
+    }
+    memset(line + len, 'x', line_len - 1 - (size_t)len);
+    line[line_len - 1] = '\n';
+    return line_len;
+}
+
+static bool send_all(int fd, const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t rc = send(fd, data, len, MSG_NOSIGNAL);
+        if(rc < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(rc <= 0)
+        {
+            return false;
+        }
+        data += rc;
+        len -= (size_t)rc;
+    }
+    return true;
+}
+
+/**
+ * Send @param line, half close and read the reply until the server closes
+ * @return the reply size or -1 on error
+ */
+static ssize_t exchange(const struct bench_config *config, const char *line, size_t len, FILE *out)
+{
+    char buf[BENCH_READ_SIZE];
+    ssize_t total = 0;
+    ssize_t rc;
+    int fd = connect_server(config);
+
+    if(fd < 0)
+    {
+        return -1;
+    }
+    if(!send_all(fd, line, len) || shutdown(fd, SHUT_WR) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    while((rc = recv(fd, buf, sizeof(buf), 0)) != 0)
+    {
+        if(rc < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            close(fd);
+            return -1;
+        }
+        if(out != NULL)
+        {
+            fwrite(buf, 1, (size_t)rc, out);
+        }
+        total += rc;
+    }
+    close(fd);
+    return total;
+}
+
+static void run_request(struct bench_client *client, char *line)
+{
+    const struct bench_config *config = client->config;
+
+    while(!atomic_load_explicit(client->stop, memory_order_relaxed))
+    {
+        size_t len = make_line(line, config->line_len, client->index, client->lines);
+        uint64_t start = now_ns();
+        ssize_t reply = exchange(config, line, len, NULL);
+
+        if(reply < 0)
+        {
+            client->errors++;
+            continue;
+        }
+        if(client->sample_count < BENCH_MAX_SAMPLES)
+        {
+            client->samples[client->sample_count++] = now_ns() - start;
+        }
+        client->lines++;
+        client->reply_bytes += (unsigned long long)reply;
+    }
+}
+
+static void run_stream(struct bench_client *client, char *line)
+{
+    const struct bench_config *config = client->config;
+    char buf[BENCH_READ_SIZE];
+    struct pollfd pfd;
+    size_t len = 0;
+    size_t sent = 0;
+    ssize_t rc;
+    bool closing = false;
+
+    pfd.fd = connect_server(config);
+    if(pfd.fd < 0)
+    {
+        client->errors++;
+        return;
+    }
+
+    for(;;)
+    {
+        if(!closing && atomic_load_explicit(client->stop, memory_order_relaxed) && sent == len)
+        {
+            /* the server closes after replying to the last line */
+            shutdown(pfd.fd, SHUT_WR);
+            closing = true;
+        }
+        if(!closing && sent == len)
+        {
+            len = make_line(line, config->line_len, client->index, client->lines);
+            sent = 0;
+        }
+
+        pfd.events = closing ? POLLIN : POLLIN | POLLOUT;
+        rc = poll(&pfd, 1, closing ? 2000 : 100);
+        if(rc < 0 && errno != EINTR)
+        {
+            client->errors++;
+            break;
+        }
+        if(rc == 0 && closing)
+        {
+            break;
+        }
+
+        if(pfd.revents & (POLLIN | POLLHUP | POLLERR))
+        {
+            rc = recv(pfd.fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if(rc == 0)
+            {
+                break;
+            }
+            if(rc < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                client->errors++;
+                break;
+            }
+            if(rc > 0)
+            {
+                client->reply_bytes += (unsigned long long)rc;
+            }
+        }
+        if(!closing && (pfd.revents & POLLOUT))
+        {
+            rc = send(pfd.fd, line + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if(rc < 0 && errno != EAGAIN && errno != EINTR)
+            {
+                client->errors++;
+                break;
+            }
+            if(rc > 0)
+            {
+                sent += (size_t)rc;
+                if(sent == len)
+                {
+                    client->lines++;
+                }
+            }
+        }
+    }
+    close(pfd.fd);
+}
+
+static void *bench_thread(void *arg)
+{
+    struct bench_client *client = (struct bench_client *)arg;
+    char *line = malloc(client->config->line_len + 64);
+
+    if(line == NULL)
+    {
+        client->errors++;
+        return NULL;
+    }
+    if(client->config->mode == MODE_REQUEST)
+    {
+        run_request(client, line);
+    }
+    else
+    {
+        run_stream(client, line);
+    }
+    free(line);
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static bool run_one(const struct bench_config *config, int clients)
+{
+    struct bench_client *threads = calloc(clients, sizeof(*threads));
+    atomic_bool stop = false;
+    unsigned long long lines = 0;
+    unsigned long long reply_bytes = 0;
+    unsigned long long errors = 0;
+    uint64_t *samples = NULL;
+    size_t sample_count = 0;
+    uint64_t start;
+    uint64_t elapsed;
+    int created;
+    int i;
+
+    if(threads == NULL)
+    {
+        return false;
+    }
+    for(created = 0; created < clients; created++)
+    {
+        threads[created].index = created;
+        threads[created].config = config;
+        threads[created].stop = &stop;
+        if(config->mode == MODE_REQUEST)
+        {
+            threads[created].samples = malloc(BENCH_MAX_SAMPLES * sizeof(uint64_t));
+        }
+        if(pthread_create(&threads[created].tid, NULL, bench_thread, &threads[created]) != 0)
+        {
+            fprintf(stderr, "Failed to create client %d\n", created);
+            break;
+        }
+    }
+
+    start = now_ns();
+    usleep(config->duration_ms * 1000);
+    atomic_store(&stop, true);
+    elapsed = now_ns() - start;
+
+    for(i = 0; i < created; i++)
+    {
+        pthread_join(threads[i].tid, NULL);
+        lines += threads[i].lines;
+        reply_bytes += threads[i].reply_bytes;
+        errors += threads[i].errors;
+        sample_count += threads[i].sample_count;
+    }
+
+    if(config->mode == MODE_REQUEST && sample_count > 0)
+    {
+        samples = malloc(sample_count * sizeof(uint64_t));
+        sample_count = 0;
+        for(i = 0; samples != NULL && i < created; i++)
+        {
+            memcpy(samples + sample_count, threads[i].samples, threads[i].sample_count * sizeof(uint64_t));
+            sample_count += threads[i].sample_count;
+        }
+        if(samples != NULL)
+        {
+            qsort(samples, sample_count, sizeof(uint64_t), compare_u64);
+        }
+    }
+
+    printf("%-7s %7d %12.0f %12.2f %10.1f %10.1f %7llu\n",
+            config->mode == MODE_REQUEST ? "request" : "stream", created,
+            lines * 1e9 / (double)elapsed, reply_bytes * 1e3 / (double)elapsed,
+            samples != NULL ? samples[sample_count / 2] / 1e3 : 0.0,
+            samples != NULL ? samples[sample_count * 99 / 100] / 1e3 : 0.0, errors);
+
+    for(i = 0; i < clients; i++)
+    {
+        free(threads[i].samples);
+    }
+    free(samples);
+    free(threads);
+    return created == clients && errors == 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-u socket_path | -p port] [-a address] [-c clients,...] "
+            "[-d duration_ms] [-l line_len] [-m stream|request]\n"
+            "       %s [-u socket_path | -p port] [-a address] -x TEXT\n", prog, prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_config config;
+    const char *text = NULL;
+    char *saveptr = NULL;
+    char *token;
+    bool ok = true;
+    int opt;
+    int i;
+
+    memset(&config, 0, sizeof(config));
+    config.address = "127.0.0.1";
+    config.port = 9000;
+    config.duration_ms = 1000;
+    config.line_len = 64;
+    config.mode = MODE_STREAM;
+    for(i = 0; i < 6; i++)
+    {
+        config.counts[i] = 1 << i;
+    }
+    config.count_count = 6;
+
+    while((opt = getopt(argc, argv, "u:p:a:c:d:l:m:x:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'u':
+                config.unix_path = optarg;
+                break;
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 'a':
+                config.address = optarg;
+                break;
+            case 'c':
+                config.count_count = 0;
+                for(token = strtok_r(optarg, ",", &saveptr); token != NULL && config.count_count < BENCH_MAX_COUNTS;
+                        token = strtok_r(NULL, ",", &saveptr))
+                {
+                    config.counts[config.count_count++] = atoi(token);
+                }
+                break;
+            case 'd':
+                config.duration_ms = (unsigned int)atoi(optarg);
+                break;
+            case 'l':
+                config.line_len = strtoul(optarg, NULL, 0);
+                break;
+            case 'm':
+                if(strcmp(optarg, "stream") == 0)
+                {
+                    config.mode = MODE_STREAM;
+                }
+                else if(strcmp(optarg, "request") == 0)
+                {
+                    config.mode = MODE_REQUEST;
+                }
+                else
+                {
+                    usage(argv[0]);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'x':
+                text = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if(text != NULL)
+    {
+        size_t len = strlen(text);
+        char *line = malloc(len + 1);
+
+        if(line == NULL)
+        {
+            return EXIT_FAILURE;
+        }
+        memcpy(line, text, len);
+        line[len] = '\n';
+        ok = exchange(&config, line, len + 1, stdout) >= 0;
+        free(line);
+        if(!ok)
+        {
+            perror("exchange");
+        }
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if(config.count_count < 1 || config.duration_ms == 0 || config.line_len < 2 || config.line_len > BENCH_MAX_LINE)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("# %s, %zu byte lines, %u ms per run\n",
+            config.unix_path != NULL ? config.unix_path : config.address, config.line_len, config.duration_ms);
+    printf("%-7s %7s %12s %12s %10s %10s %7s\n",
+            "mode", "clients", "lines/s", "reply_MB/s", "p50_us", "p99_us", "errors");
+    for(i = 0; i < config.count_count; i++)
+    {
+        ok = run_one(&config, config.counts[i]) && ok;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
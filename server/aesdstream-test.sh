@@ -0,0 +1,105 @@
+#!/bin/sh
+# Localhost test of aesdstream over a Unix socket and loopback TCP.
+# Uses aesdstream with /dev/aesdchar when the module is loaded, otherwise
+# aesdstream-shim, which runs the driver in the server process.
+
+cd `dirname $0`
+rc=0
+sock=$(mktemp -u /tmp/aesdstream.XXXXXX)
+port=${AESDSTREAM_TEST_PORT:-9000}
+server_pid=
+
+if [ -c /dev/aesdchar ]; then
+	server=./aesdstream
+else
+	server=./aesdstream-shim
+fi
+make ${server#./} aesdstream-bench > /dev/null || exit 1
+
+start_server()
+{
+	${server} "$@" -v 2> /dev/null &
+	server_pid=$!
+	# wait for the listener
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		if ./aesdstream-bench ${transport} -x "ping" > /dev/null 2>&1; then
+			return 0
+		fi
+		sleep 0.2
+	done
+	echo "server did not start"
+	rc=1
+	return 1
+}
+
+stop_server()
+{
+	kill -TERM ${server_pid}
+	wait ${server_pid}
+	if [ $? -ne 0 ]; then
+		echo "server exited with an error"
+		rc=1
+	fi
+}
+
+check_output()
+{
+	local read_file=$1
+	local expected_file=$2
+	diff ${read_file} ${expected_file}
+	if [ $? -ne 0 ]; then
+		echo "difference detected, expected:"
+		cat ${expected_file}
+		echo "but found"
+		cat ${read_file}
+		rc=1
+	fi
+}
+
+run_tests()
+{
+	read_file=$(mktemp)
+	expected_file=$(mktemp)
+
+	echo "Sequential writes over ${transport}"
+	for i in 1 2 3 4 5 6 7 8 9 10 11; do
+		./aesdstream-bench ${transport} -x "write${i}" > ${read_file}
+	done
+	for i in 2 3 4 5 6 7 8 9 10 11; do
+		echo "write${i}"
+	done > ${expected_file}
+	check_output ${read_file} ${expected_file}
+
+	echo "Concurrent clients over ${transport}"
+	./aesdstream-bench ${transport} -c 8 -d 300 -l 300 > /dev/null
+	if [ $? -ne 0 ]; then
+		echo "benchmark clients reported errors"
+		rc=1
+	fi
+	./aesdstream-bench ${transport} -x "check" > ${read_file}
+	if grep -v -x -e 'client [0-9]* line [0-9]* x*' -e 'check' ${read_file}; then
+		echo "lines of concurrent clients were mixed"
+		rc=1
+	fi
+	if [ "$(tail -n 1 ${read_file})" != "check" ]; then
+		echo "reply does not end with the line just written"
+		rc=1
+	fi
+
+	rm -f ${read_file} ${expected_file}
+}
+
+transport="-u ${sock}"
+start_server -u ${sock} && run_tests
+stop_server
+
+transport="-p ${port}"
+start_server -p ${port} -s 4 && run_tests
+stop_server
+
+if [ ${rc} -eq 0 ]; then
+	echo "aesdstream tests passed"
+else
+	echo "aesdstream tests failed"
+fi
+exit ${rc}
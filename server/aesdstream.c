@@ -0,0 +1,885 @@
+/**
+ * @file aesdstream.c
+ * @brief epoll driven socket front-end for /dev/aesdchar
+ *
+ * Clients connect over a Unix socket or loopback TCP and send newline
+ * terminated lines.  Each shard is one thread with its own epoll instance;
+ * all shards wait on the shared listening socket with EPOLLEXCLUSIVE so a new
+ * connection wakes a single shard.  The complete lines every client sent
+ * during one pass of a shard's event loop are forwarded to the device with a
+ * single writev(), one segment per client so lines are never interleaved.
+ * Each client whose lines were written is then sent the whole device content,
+ * with sendfile() where the device supports it and read()/send() otherwise.
+ *
+ * While a reply is in progress the client's socket is not read, so a client
+ * that does not read its replies is held back by its own socket buffers
+ * instead of filling the device and the server's memory.  A client that
+ * half closes its connection gets the reply to its last lines before the
+ * connection is closed.
+ *
+ * Built as aesdstream the server opens the device node (default
+ * /dev/aesdchar).  Built as aesdstream-shim (-DAESD_STREAM_SHIM) it links
+ * the driver against the userspace shim like aesdchar-stress-shim, so it can
+ * be tested on any host.  Module parameters are then given with -o name=value.
+ *
+ * Usage: aesdstream [-u socket_path | -p port] [-a address] [-s shards]
+ *                   [-d device] [-m max_line] [-o param=value] [-v]
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "async-log.h"
+#ifdef AESD_STREAM_SHIM
+#include "shim/aesd-shim-api.h"
+#endif
+
+#define STREAM_DEFAULT_PORT 9000
+#define STREAM_DEFAULT_DEVICE "/dev/aesdchar"
+#define STREAM_DEFAULT_MAX_LINE (1024 * 1024)
+#define STREAM_MAX_SHARDS 64
+/* events handled per pass, which also bounds the segments of one writev() */
+#define STREAM_MAX_EVENTS 64
+/* initial size of a client's line buffer and most bytes read per event */
+#define STREAM_READ_CHUNK 4096
+/* bytes per sendfile() or read() of a reply */
+#define STREAM_SEND_CHUNK 65536
+
+struct stream_config
+{
+    const char *device;
+    const char *unix_path;
+    const char *address;
+    int port;
+    int shards;
+    size_t max_line;
+};
+
+struct stream_dev
+{
+    int fd;
+#ifdef AESD_STREAM_SHIM
+    struct aesd_shim_file *file;
+    long long pos;
+#endif
+};
+
+struct client
+{
+    int fd;
+    char peer[64];
+    /* received data, the complete lines among it are forwarded by the next writev() */
+    char *in;
+    size_t in_len;
+    size_t in_size;
+    /* bytes of complete lines at the start of in which are part of the current batch */
+    size_t in_batched;
+    /* device opened for the reply in progress, fd -1 when there is none */
+    struct stream_dev reply;
+    bool replying;
+    /* read()/send() fallback, out_len bytes of which out_sent were sent */
+    char *out;
+    size_t out_len;
+    size_t out_sent;
+    /* events currently registered with the shard's epoll instance */
+    uint32_t events;
+    /* clients of the same shard */
+    struct client *prev;
+    struct client *next;
+};
+
+struct shard
+{
+    int index;
+    pthread_t thread;
+    int epfd;
+    /* device opened for writing, shared by all clients of the shard */
+    struct stream_dev dev;
+    /* cleared once the device refused sendfile() */
+    bool use_sendfile;
+    struct client *clients_list;
+    struct client *batch[STREAM_MAX_EVENTS];
+    int batch_count;
+    unsigned long long batches;
+    unsigned long long bytes_written;
+    unsigned long long replies;
+    unsigned long long clients;
+};
+
+static struct stream_config config;
+static int listen_fd = -1;
+static int stop_fd = -1;
+/* epoll_event.data.ptr of the listening socket and of stop_fd */
+static char listen_tag;
+static char stop_tag;
+
+#ifdef AESD_STREAM_SHIM
+
+static bool dev_open(struct stream_dev *dev, int flags)
+{
+    (void)flags;
+    dev->fd = -1;
+    dev->pos = 0;
+    dev->file = aesd_shim_open();
+    return dev->file != NULL;
+}
+
+static void dev_close(struct stream_dev *dev)
+{
+    if(dev->file != NULL)
+    {
+        aesd_shim_release(dev->file);
+        dev->file = NULL;
+    }
+}
+
+static ssize_t dev_writev(struct stream_dev *dev, const struct iovec *iov, int count)
+{
+    ssize_t total = 0;
+    int i;
+
+    /* the kernel calls the driver's write once per segment as well */
+    for(i = 0; i < count; i++)
+    {
+        ssize_t rc = aesd_shim_write(dev->file, iov[i].iov_base, iov[i].iov_len);
+        if(rc < 0)
+        {
+            if(total > 0)
+            {
+                return total;
+            }
+            errno = (int)-rc;
+            return -1;
+        }
+        total += rc;
+        if((size_t)rc < iov[i].iov_len)
+        {
+            break;
+        }
+    }
+    return total;
+}
+
+static ssize_t dev_read(struct stream_dev *dev, char *buf, size_t count)
+{
+    ssize_t rc = aesd_shim_read(dev->file, buf, count, &dev->pos);
+
+    if(rc < 0)
+    {
+        errno = (int)-rc;
+        return -1;
+    }
+    return rc;
+}
+
+#else
+
+static bool dev_open(struct stream_dev *dev, int flags)
+{
+    dev->fd = open(config.device, flags | O_CLOEXEC);
+    if(dev->fd < 0)
+    {
+        ASYNC_LOG(LOG_ERR, "Failed to open %s: %s\n", config.device, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+static void dev_close(struct stream_dev *dev)
+{
+    if(dev->fd >= 0)
+    {
+        close(dev->fd);
+        dev->fd = -1;
+    }
+}
+
+static ssize_t dev_writev(struct stream_dev *dev, const struct iovec *iov, int count)
+{
+    return writev(dev->fd, iov, count);
+}
+
+static ssize_t dev_read(struct stream_dev *dev, char *buf, size_t count)
+{
+    return read(dev->fd, buf, count);
+}
+
+#endif
+
+static void client_watch(struct shard *shard, struct client *client, uint32_t events)
+{
+    struct epoll_event ev;
+
+    if(client->events == events)
+    {
+        return;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = client;
+    if(epoll_ctl(shard->epfd, EPOLL_CTL_MOD, client->fd, &ev) != 0)
+    {
+        ASYNC_LOG(LOG_ERR, "epoll_ctl failed for %s: %s\n", client->peer, strerror(errno));
+    }
+    client->events = events;
+}
+
+static void client_close(struct shard *shard, struct client *client)
+{
+    ASYNC_LOG(LOG_INFO, "Closed connection from %s\n", client->peer);
+    epoll_ctl(shard->epfd, EPOLL_CTL_DEL, client->fd, NULL);
+    close(client->fd);
+    if(client->prev != NULL)
+    {
+        client->prev->next = client->next;
+    }
+    else
+    {
+        shard->clients_list = client->next;
+    }
+    if(client->next != NULL)
+    {
+        client->next->prev = client->prev;
+    }
+    if(client->replying)
+    {
+        dev_close(&client->reply);
+    }
+    free(client->in);
+    free(client->out);
+    free(client);
+}
+
+static void accept_clients(struct shard *shard)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    struct epoll_event ev;
+    struct client *client;
+    int one = 1;
+    int fd;
+
+    for(;;)
+    {
+        addr_len = sizeof(addr);
+        fd = accept4(listen_fd, (struct sockaddr *)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                ASYNC_LOG(LOG_ERR, "accept failed: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        client = calloc(1, sizeof(*client));
+        if(client == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        client->reply.fd = -1;
+        if(addr.ss_family == AF_INET)
+        {
+            struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+            snprintf(client->peer, sizeof(client->peer), "%s:%u", ip, ntohs(in->sin_port));
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        else
+        {
+            snprintf(client->peer, sizeof(client->peer), "unix:%d", fd);
+        }
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = client;
+        if(epoll_ctl(shard->epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        {
+            ASYNC_LOG(LOG_ERR, "epoll_ctl failed for %s: %s\n", client->peer, strerror(errno));
+            close(fd);
+            free(client);
+            continue;
+        }
+        client->events = EPOLLIN;
+        client->next = shard->clients_list;
+        if(client->next != NULL)
+        {
+            client->next->prev = client;
+        }
+        shard->clients_list = client;
+        shard->clients++;
+        ASYNC_LOG(LOG_INFO, "Accepted connection from %s on shard %d\n", client->peer, shard->index);
+    }
+}
+
+/**
+ * Send the device content to @param client until it is all sent or the socket is full
+ * @return false if the client was closed
+ */
+static bool continue_reply(struct shard *shard, struct client *client)
+{
+    ssize_t rc;
+
+    for(;;)
+    {
+        if(shard->use_sendfile && client->out_sent == client->out_len)
+        {
+            rc = sendfile(client->fd, client->reply.fd, NULL, STREAM_SEND_CHUNK);
+            if(rc > 0)
+            {
+                continue;
+            }
+            if(rc == 0)
+            {
+                break;
+            }
+            if(errno == EAGAIN)
+            {
+                client_watch(shard, client, EPOLLOUT);
+                return true;
+            }
+            if(errno != EINVAL && errno != ENOSYS)
+            {
+                ASYNC_LOG(LOG_ERR, "sendfile to %s failed: %s\n", client->peer, strerror(errno));
+                client_close(shard, client);
+                return false;
+            }
+            /* the device has no splice support, nothing was sent */
+            ASYNC_LOG(LOG_INFO, "sendfile not supported by %s, using read and send\n", config.device);
+            shard->use_sendfile = false;
+        }
+
+        if(client->out_sent == client->out_len)
+        {
+            if(client->out == NULL)
+            {
+                client->out = malloc(STREAM_SEND_CHUNK);
+                if(client->out == NULL)
+                {
+                    client_close(shard, client);
+                    return false;
+                }
+            }
+            rc = dev_read(&client->reply, client->out, STREAM_SEND_CHUNK);
+            if(rc < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if(rc < 0)
+            {
+                ASYNC_LOG(LOG_ERR, "Reading %s failed: %s\n", config.device, strerror(errno));
+                client_close(shard, client);
+                return false;
+            }
+            if(rc == 0)
+            {
+                break;
+            }
+            client->out_len = (size_t)rc;
+            client->out_sent = 0;
+        }
+
+        rc = send(client->fd, client->out + client->out_sent, client->out_len - client->out_sent,
+                MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(rc < 0)
+        {
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                client_watch(shard, client, EPOLLOUT);
+                return true;
+            }
+            if(errno != EINTR)
+            {
+                ASYNC_LOG(LOG_ERR, "send to %s failed: %s\n", client->peer, strerror(errno));
+                client_close(shard, client);
+                return false;
+            }
+            continue;
+        }
+        client->out_sent += (size_t)rc;
+    }
+
+    dev_close(&client->reply);
+    client->replying = false;
+    client->out_len = 0;
+    client->out_sent = 0;
+    shard->replies++;
+    /* a client which shut down its side is closed by the next read */
+    client_watch(shard, client, EPOLLIN);
+    return true;
+}
+
+static void start_reply(struct shard *shard, struct client *client)
+{
+    if(!dev_open(&client->reply, O_RDONLY))
+    {
+        client_close(shard, client);
+        return;
+    }
+    client->replying = true;
+    continue_reply(shard, client);
+}
+
+static void read_client(struct shard *shard, struct client *client)
+{
+    const char *newline;
+    size_t old_len = client->in_len;
+    ssize_t rc;
+
+    if(client->in_len == client->in_size)
+    {
+        size_t size = client->in_size != 0 ? client->in_size * 2 : STREAM_READ_CHUNK;
+        char *in;
+
+        if(client->in_size >= config.max_line)
+        {
+            ASYNC_LOG(LOG_ERR, "Line from %s longer than %zu bytes, closing\n", client->peer, config.max_line);
+            client_close(shard, client);
+            return;
+        }
+        if(size > config.max_line)
+        {
+            size = config.max_line;
+        }
+        in = realloc(client->in, size);
+        if(in == NULL)
+        {
+            client_close(shard, client);
+            return;
+        }
+        client->in = in;
+        client->in_size = size;
+    }
+
+    rc = read(client->fd, client->in + client->in_len, client->in_size - client->in_len);
+    if(rc < 0)
+    {
+        if(errno != EAGAIN && errno != EINTR)
+        {
+            client_close(shard, client);
+        }
+        return;
+    }
+    if(rc == 0)
+    {
+        if(client->in_len != 0)
+        {
+            ASYNC_LOG(LOG_INFO, "Dropping %zu bytes without newline from %s\n", client->in_len, client->peer);
+        }
+        client_close(shard, client);
+        return;
+    }
+    client->in_len += (size_t)rc;
+
+    newline = memrchr(client->in + old_len, '\n', (size_t)rc);
+    if(newline != NULL)
+    {
+        /* not read again until the reply to these lines is sent */
+        client->in_batched = (size_t)(newline - client->in) + 1;
+        shard->batch[shard->batch_count++] = client;
+        client_watch(shard, client, 0);
+    }
+}
+
+/**
+ * Write the lines collected during this pass and start the replies
+ */
+static void finish_batch(struct shard *shard)
+{
+    struct iovec iov[STREAM_MAX_EVENTS];
+    struct iovec *next = iov;
+    int remaining = shard->batch_count;
+    size_t total = 0;
+    ssize_t rc;
+    int i;
+
+    if(shard->batch_count == 0)
+    {
+        return;
+    }
+    for(i = 0; i < shard->batch_count; i++)
+    {
+        iov[i].iov_base = shard->batch[i]->in;
+        iov[i].iov_len = shard->batch[i]->in_batched;
+        total += iov[i].iov_len;
+    }
+
+    while(remaining > 0)
+    {
+        rc = dev_writev(&shard->dev, next, remaining);
+        if(rc < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(rc <= 0)
+        {
+            ASYNC_LOG(LOG_ERR, "Writing to %s failed, %d clients' lines dropped: %s\n",
+                    config.device, remaining, rc < 0 ? strerror(errno) : "no progress");
+            break;
+        }
+        shard->bytes_written += (size_t)rc;
+        while(remaining > 0 && (size_t)rc >= next->iov_len)
+        {
+            rc -= (ssize_t)next->iov_len;
+            next++;
+            remaining--;
+        }
+        if(remaining > 0)
+        {
+            next->iov_base = (char *)next->iov_base + rc;
+            next->iov_len -= (size_t)rc;
+        }
+    }
+    shard->batches++;
+
+    for(i = 0; i < shard->batch_count; i++)
+    {
+        struct client *client = shard->batch[i];
+
+        client->in_len -= client->in_batched;
+        memmove(client->in, client->in + client->in_batched, client->in_len);
+        client->in_batched = 0;
+        start_reply(shard, client);
+    }
+    shard->batch_count = 0;
+}
+
+static void *shard_thread(void *arg)
+{
+    struct shard *shard = (struct shard *)arg;
+    struct epoll_event events[STREAM_MAX_EVENTS];
+    bool stop = false;
+    int count;
+    int i;
+
+    while(!stop)
+    {
+        count = epoll_wait(shard->epfd, events, STREAM_MAX_EVENTS, -1);
+        if(count < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            ASYNC_LOG(LOG_ERR, "epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for(i = 0; i < count; i++)
+        {
+            struct client *client = events[i].data.ptr;
+
+            if(events[i].data.ptr == &listen_tag)
+            {
+                accept_clients(shard);
+            }
+            else if(events[i].data.ptr == &stop_tag)
+            {
+                stop = true;
+            }
+            else if(client->replying)
+            {
+                /* EPOLLOUT, or an error the next send reports */
+                continue_reply(shard, client);
+            }
+            else if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                read_client(shard, client);
+            }
+        }
+        finish_batch(shard);
+    }
+
+    while(shard->clients_list != NULL)
+    {
+        client_close(shard, shard->clients_list);
+    }
+    return NULL;
+}
+
+static void handle_signal(int sig)
+{
+    uint64_t one = 1;
+    int saved_errno = errno;
+
+    (void)sig;
+    if(write(stop_fd, &one, sizeof(one)) < 0)
+    {
+        /* nothing to do, the counter can only overflow */
+    }
+    errno = saved_errno;
+}
+
+static int open_listener(void)
+{
+    int fd;
+    int one = 1;
+
+    if(config.unix_path != NULL)
+    {
+        struct sockaddr_un addr;
+
+        if(strlen(config.unix_path) >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Socket path %s too long\n", config.unix_path);
+            return -1;
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+        {
+            perror("socket");
+            return -1;
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, config.unix_path);
+        unlink(config.unix_path);
+        if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            fprintf(stderr, "Failed to bind %s: %s\n", config.unix_path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+    else
+    {
+        struct sockaddr_in addr;
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+        {
+            perror("socket");
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)config.port);
+        if(inet_pton(AF_INET, config.address, &addr.sin_addr) != 1)
+        {
+            fprintf(stderr, "Invalid address %s\n", config.address);
+            close(fd);
+            return -1;
+        }
+        if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        {
+            fprintf(stderr, "Failed to bind %s:%d: %s\n", config.address, config.port, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    if(listen(fd, SOMAXCONN) != 0)
+    {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool shard_init(struct shard *shard, int index)
+{
+    struct epoll_event ev;
+
+    memset(shard, 0, sizeof(*shard));
+    shard->index = index;
+    shard->use_sendfile = true;
+#ifdef AESD_STREAM_SHIM
+    shard->use_sendfile = false;
+#endif
+    shard->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(shard->epfd < 0)
+    {
+        perror("epoll_create1");
+        return false;
+    }
+    if(!dev_open(&shard->dev, O_WRONLY))
+    {
+        fprintf(stderr, "Failed to open %s\n", config.device);
+        close(shard->epfd);
+        return false;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listen_tag;
+    if(epoll_ctl(shard->epfd, EPOLL_CTL_ADD, listen_fd, &ev) != 0)
+    {
+        perror("epoll_ctl");
+        return false;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = &stop_tag;
+    if(epoll_ctl(shard->epfd, EPOLL_CTL_ADD, stop_fd, &ev) != 0)
+    {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-u socket_path | -p port] [-a address] [-s shards] [-d device] "
+            "[-m max_line] [-o param=value] [-v]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    struct async_log_config log_config;
+    struct shard *shards;
+    struct sigaction action;
+    bool verbose = false;
+    int started;
+    int opt;
+    int i;
+#ifdef AESD_STREAM_SHIM
+    char *value;
+#endif
+
+    config.device = STREAM_DEFAULT_DEVICE;
+    config.address = "127.0.0.1";
+    config.port = STREAM_DEFAULT_PORT;
+    config.shards = 1;
+    config.max_line = STREAM_DEFAULT_MAX_LINE;
+
+    while((opt = getopt(argc, argv, "u:p:a:s:d:m:o:v")) != -1)
+    {
+        switch(opt)
+        {
+            case 'u':
+                config.unix_path = optarg;
+                break;
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 'a':
+                config.address = optarg;
+                break;
+            case 's':
+                config.shards = atoi(optarg);
+                break;
+            case 'd':
+                config.device = optarg;
+                break;
+            case 'm':
+                config.max_line = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+#ifdef AESD_STREAM_SHIM
+                value = strchr(optarg, '=');
+                if(value != NULL)
+                {
+                    *value++ = '\0';
+                }
+                if(value == NULL || aesd_shim_set_param(optarg, value) != 0)
+                {
+                    fprintf(stderr, "Invalid module parameter %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+#else
+                fprintf(stderr, "-o is only supported by aesdstream-shim\n");
+                return EXIT_FAILURE;
+#endif
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if(config.shards < 1 || config.shards > STREAM_MAX_SHARDS || config.max_line == 0
+            || config.port <= 0 || config.port > 65535)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* messages go to syslog like the other daemons, or to stderr with -v */
+    memset(&log_config, 0, sizeof(log_config));
+    log_config.sink = verbose ? ASYNC_LOG_SINK_STREAM : ASYNC_LOG_SINK_SYSLOG;
+    log_config.stream = stderr;
+    openlog("aesdstream", 0, LOG_USER);
+    async_log_init(&log_config);
+
+#ifdef AESD_STREAM_SHIM
+    config.device = "<shim>";
+    if(aesd_shim_init() != 0)
+    {
+        fprintf(stderr, "aesd_init_module failed\n");
+        return EXIT_FAILURE;
+    }
+#endif
+
+    listen_fd = open_listener();
+    stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shards = calloc(config.shards, sizeof(*shards));
+    if(listen_fd < 0 || stop_fd < 0 || shards == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for(started = 0; started < config.shards; started++)
+    {
+        if(!shard_init(&shards[started], started)
+                || pthread_create(&shards[started].thread, NULL, shard_thread, &shards[started]) != 0)
+        {
+            fprintf(stderr, "Failed to start shard %d\n", started);
+            handle_signal(SIGTERM);
+            break;
+        }
+    }
+    ASYNC_LOG(LOG_INFO, "Listening on %s with %d shards, device %s\n",
+            config.unix_path != NULL ? config.unix_path : config.address, started, config.device);
+
+    for(i = 0; i < started; i++)
+    {
+        pthread_join(shards[i].thread, NULL);
+        ASYNC_LOG(LOG_INFO, "Shard %d: %llu clients, %llu batches, %llu bytes written, %llu replies\n",
+                i, shards[i].clients, shards[i].batches, shards[i].bytes_written, shards[i].replies);
+        dev_close(&shards[i].dev);
+        close(shards[i].epfd);
+    }
+    ASYNC_LOG(LOG_INFO, "Caught signal, exiting\n");
+
+    close(listen_fd);
+    if(config.unix_path != NULL)
+    {
+        unlink(config.unix_path);
+    }
+#ifdef AESD_STREAM_SHIM
+    aesd_shim_exit();
+#endif
+    free(shards);
+    return started == config.shards ? EXIT_SUCCESS : EXIT_FAILURE;
+}